@@ -0,0 +1,495 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Stand-ins and load generator for `make bench`.
+ *
+ *   puttle-bench echo  --port P        echoes what it receives
+ *   puttle-bench sink  --port P        discards what it receives
+ *   puttle-bench proxy --port P [--auth none|basic|digest] [--user U --password W]
+ *                      [--fast-open]   minimal HTTP CONNECT proxy
+ *   puttle-bench load  --port P [--mode connect|stream] [--threads N]
+ *                      [--duration S] [--size B]
+ *                                      drives puttle and prints the results as JSON
+ *
+ * The servers use a thread per connection and blocking sockets: they are
+ * simple enough not to be the bottleneck of a loopback benchmark.
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <openssl/md5.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>  // NOLINT
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+namespace po = ::boost::program_options;
+
+namespace {
+
+const char* REALM = "puttle-bench";
+
+struct Options {
+    Options() : port(0), threads(4), duration(10), size(64), mode("connect"), auth("none"),
+        fast_open(false) {
+    }
+
+    int port;
+    int threads;
+    int duration;
+    size_t size;
+    std::string mode;
+    std::string auth;
+    std::string user;
+    std::string password;
+    std::string nonce;
+    bool fast_open;
+};
+
+uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+int listen_on(int port, bool fast_open) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (fast_open) {
+        // Queue of pending fast open requests
+        int queue = 1024;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &queue, sizeof(queue)) != 0)
+            perror("TCP_FASTOPEN");
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 1024) != 0) {
+        perror("listen");
+        exit(1);
+    }
+    return fd;
+}
+
+int connect_to(const std::string& host, int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_all(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void serve(int port, bool fast_open, boost::function<void (int)> session) {
+    int listener = listen_on(port, fast_open);
+    for (;;) {
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        boost::thread(session, fd).detach();
+    }
+}
+
+void echo_session(int fd) {
+    char buffer[65536];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        if (!write_all(fd, buffer, n))
+            break;
+    }
+    close(fd);
+}
+
+void sink_session(int fd) {
+    char buffer[65536];
+    while (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+    }
+    close(fd);
+}
+
+// Relays both ways, each EOF is passed on, until both sides are done
+void relay(int a, int b) {
+    char buffer[65536];
+    struct pollfd fds[2] = { { a, POLLIN, 0 }, { b, POLLIN, 0 } };
+    int open = 2;
+
+    while (open > 0 && poll(fds, 2, -1) >= 0) {
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i].fd < 0 || !fds[i].revents)
+                continue;
+
+            int peer = i == 0 ? b : a;
+            ssize_t n = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+            if (n > 0 && write_all(peer, buffer, n))
+                continue;
+
+            shutdown(peer, SHUT_WR);
+            fds[i].fd = -1;
+            --open;
+        }
+    }
+    close(a);
+    close(b);
+}
+
+std::string md5_hex(const std::string& data) {
+    unsigned char digest[MD5_DIGEST_LENGTH];
+    MD5(reinterpret_cast<const unsigned char*>(data.data()), data.size(), digest);
+
+    static const char hex[] = "0123456789abcdef";
+    std::string result;
+    for (size_t i = 0; i < MD5_DIGEST_LENGTH; ++i) {
+        result += hex[digest[i] >> 4];
+        result += hex[digest[i] & 0xf];
+    }
+    return result;
+}
+
+std::string base64(const std::string& data) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string result;
+    for (size_t i = 0; i < data.size(); i += 3) {
+        uint32_t n = static_cast<uint8_t>(data[i]) << 16;
+        if (i + 1 < data.size())
+            n |= static_cast<uint8_t>(data[i + 1]) << 8;
+        if (i + 2 < data.size())
+            n |= static_cast<uint8_t>(data[i + 2]);
+
+        result += table[(n >> 18) & 63];
+        result += table[(n >> 12) & 63];
+        result += i + 1 < data.size() ? table[(n >> 6) & 63] : '=';
+        result += i + 2 < data.size() ? table[n & 63] : '=';
+    }
+    return result;
+}
+
+std::string header_value(const std::string& headers, const std::string& name) {
+    std::string needle = "\r\n" + name + ":";
+    size_t start = headers.find(needle);
+    if (start == std::string::npos)
+        return std::string();
+    start += needle.size();
+    while (start < headers.size() && headers[start] == ' ')
+        ++start;
+    return headers.substr(start, headers.find("\r\n", start) - start);
+}
+
+std::string digest_param(const std::string& header, const std::string& name) {
+    size_t start = header.find(name + "=");
+    if (start == std::string::npos)
+        return std::string();
+    start += name.size() + 1;
+    if (header[start] == '"')
+        return header.substr(start + 1, header.find('"', start + 1) - start - 1);
+    return header.substr(start, header.find_first_of(", ", start) - start);
+}
+
+bool authorized(const Options& options, const std::string& headers, const std::string& uri) {
+    std::string credentials = header_value(headers, "Proxy-Authorization");
+
+    if (options.auth == "basic")
+        return credentials == "Basic " + base64(options.user + ":" + options.password);
+
+    if (options.auth == "digest") {
+        if (credentials.compare(0, 7, "Digest ") != 0 || digest_param(credentials, "uri") != uri ||
+                digest_param(credentials, "username") != options.user)
+            return false;
+        std::string ha1 = md5_hex(options.user + ":" + REALM + ":" + options.password);
+        std::string ha2 = md5_hex("CONNECT:" + uri);
+        std::string expected = md5_hex(ha1 + ":" + options.nonce + ":" + digest_param(credentials, "nc") + ":" +
+                                       digest_param(credentials, "cnonce") + ":auth:" + ha2);
+        return digest_param(credentials, "response") == expected;
+    }
+    return true;
+}
+
+void proxy_session(const Options& options, int fd) {
+    std::string received;
+    char buffer[4096];
+
+    for (;;) {
+        size_t end;
+        while ((end = received.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                close(fd);
+                return;
+            }
+            received.append(buffer, n);
+        }
+
+        std::string headers = received.substr(0, end + 2);
+        received.erase(0, end + 4);
+
+        // CONNECT host:port HTTP/1.1
+        size_t uri_start = headers.find(' ') + 1;
+        std::string uri = headers.substr(uri_start, headers.find(' ', uri_start) - uri_start);
+
+        if (!authorized(options, headers, uri)) {
+            std::string challenge = options.auth == "basic" ?
+                                    std::string("Basic realm=\"") + REALM + "\"" :
+                                    std::string("Digest realm=\"") + REALM + "\", qop=\"auth\", nonce=\"" +
+                                    options.nonce + "\", algorithm=MD5";
+            std::string answer = "HTTP/1.1 407 Proxy Authentication Required\r\n"
+                                 "Proxy-Authenticate: " + challenge + "\r\n"
+                                 "Content-Length: 0\r\n"
+                                 "Proxy-Connection: keep-alive\r\n\r\n";
+            if (!write_all(fd, answer.data(), answer.size()))
+                break;
+            continue;
+        }
+
+        size_t colon = uri.rfind(':');
+        int upstream = -1;
+        if (colon != std::string::npos)
+            upstream = connect_to(uri.substr(0, colon), atoi(uri.c_str() + colon + 1));
+        if (upstream < 0) {
+            const char answer[] = "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\n\r\n";
+            write_all(fd, answer, sizeof(answer) - 1);
+            break;
+        }
+
+        const char answer[] = "HTTP/1.1 200 Connection established\r\n\r\n";
+        if (write_all(fd, answer, sizeof(answer) - 1) &&
+                write_all(upstream, received.data(), received.size())) {
+            relay(fd, upstream);
+            return;
+        }
+        close(upstream);
+        break;
+    }
+    close(fd);
+}
+
+struct Worker {
+    Worker() : connections(0), errors(0), bytes(0) {
+    }
+
+    std::vector<uint32_t> latencies;  // Microseconds per connection
+    uint64_t connections;
+    uint64_t errors;
+    uint64_t bytes;
+};
+
+// One connection after the other: connect, send `size` bytes, read them back, close
+void connect_load(const Options& options, uint64_t deadline, Worker* worker) {
+    std::string payload(options.size, 'x');
+    std::vector<char> answer(options.size);
+
+    while (now_us() < deadline) {
+        uint64_t start = now_us();
+        int fd = connect_to("127.0.0.1", options.port);
+        if (fd < 0) {
+            ++worker->errors;
+            continue;
+        }
+
+        if (write_all(fd, payload.data(), payload.size()) && read_all(fd, answer.data(), answer.size())) {
+            worker->latencies.push_back(now_us() - start);
+            ++worker->connections;
+            worker->bytes += options.size;
+        } else {
+            ++worker->errors;
+        }
+        close(fd);
+    }
+}
+
+// One long connection sending as fast as it can
+void stream_load(const Options& options, uint64_t deadline, Worker* worker) {
+    std::string payload(std::max<size_t>(options.size, 1), 'x');
+
+    int fd = connect_to("127.0.0.1", options.port);
+    if (fd < 0) {
+        ++worker->errors;
+        return;
+    }
+
+    ++worker->connections;
+    while (now_us() < deadline) {
+        if (!write_all(fd, payload.data(), payload.size())) {
+            ++worker->errors;
+            break;
+        }
+        worker->bytes += payload.size();
+    }
+    close(fd);
+}
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double q) {
+    if (sorted.empty())
+        return 0;
+    return sorted[std::min<size_t>(static_cast<size_t>(q * sorted.size()), sorted.size() - 1)];
+}
+
+int load(const Options& options) {
+    boost::ptr_vector<Worker> workers;
+    boost::thread_group threads;
+
+    uint64_t start = now_us();
+    uint64_t deadline = start + options.duration * 1000000ULL;
+    for (int i = 0; i < options.threads; ++i) {
+        workers.push_back(new Worker());
+        if (options.mode == "stream")
+            threads.create_thread(boost::bind(&stream_load, boost::cref(options), deadline, &workers.back()));
+        else
+            threads.create_thread(boost::bind(&connect_load, boost::cref(options), deadline, &workers.back()));
+    }
+    threads.join_all();
+    double elapsed = (now_us() - start) / 1e6;
+
+    Worker total;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        total.connections += workers[i].connections;
+        total.errors += workers[i].errors;
+        total.bytes += workers[i].bytes;
+        total.latencies.insert(total.latencies.end(), workers[i].latencies.begin(), workers[i].latencies.end());
+    }
+    std::sort(total.latencies.begin(), total.latencies.end());
+
+    printf("{\"mode\": \"%s\", \"threads\": %d, \"size\": %lu, \"duration\": %.3f, "
+           "\"connections\": %lu, \"errors\": %lu, \"connections_per_sec\": %.1f, "
+           "\"throughput_mbps\": %.2f, \"latency_us\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u}}\n",
+           options.mode.c_str(), options.threads, static_cast<unsigned long>(options.size), elapsed,
+           static_cast<unsigned long>(total.connections), static_cast<unsigned long>(total.errors),
+           total.connections / elapsed, total.bytes * 8 / elapsed / 1e6,
+           percentile(total.latencies, 0.5), percentile(total.latencies, 0.9),
+           percentile(total.latencies, 0.99), total.latencies.empty() ? 0 : total.latencies.back());
+    return total.connections > 0 ? 0 : 1;
+}
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    std::string command;
+
+    po::options_description description("puttle-bench echo|sink|proxy|load [options]");
+    description.add_options()
+    ("port", po::value<int>(&options.port), "Port to listen to, or of puttle for load")
+    ("auth", po::value<std::string>(&options.auth), "proxy: authentication required [none | basic | digest]")
+    ("user", po::value<std::string>(&options.user), "proxy: user name")
+    ("password", po::value<std::string>(&options.password), "proxy: password")
+    ("fast-open", po::value<bool>(&options.fast_open)->implicit_value(true),
+     "proxy: accept TCP Fast Open connections")
+    ("mode", po::value<std::string>(&options.mode),
+     "load: [connect | stream]\nconnect opens short echo tunnels one after the other, " \
+     "stream sends to a sink over one tunnel per thread")
+    ("threads", po::value<int>(&options.threads), "load: threads")
+    ("duration", po::value<int>(&options.duration), "load: seconds")
+    ("size", po::value<size_t>(&options.size), "load: bytes echoed per connection, or per write")
+    ("help,h", "print this message");
+
+    po::options_description all_opt;
+    all_opt.add(description);
+    all_opt.add_options()
+    ("command", po::value<std::string>(&command), "");
+
+    po::positional_options_description positional;
+    positional.add("command", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(all_opt).positional(positional).run(), vm);
+        po::notify(vm);
+    } catch(const po::error& e) {
+        std::cerr << "Error in command line: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (vm.count("help") || options.port <= 0) {
+        std::cout << description << std::endl;
+        return 1;
+    }
+
+    if (command == "echo") {
+        serve(options.port, false, &echo_session);
+    } else if (command == "sink") {
+        serve(options.port, false, &sink_session);
+    } else if (command == "proxy") {
+        options.nonce = md5_hex(boost::lexical_cast<std::string>(now_us()));
+        serve(options.port, options.fast_open, boost::bind(&proxy_session, boost::cref(options), _1));
+    } else if (command == "load") {
+        return load(options);
+    } else {
+        std::cout << description << std::endl;
+        return 1;
+    }
+    return 0;
+}
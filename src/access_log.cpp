@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <access_log.h>
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <boost/lexical_cast.hpp>
+
+namespace puttle {
+
+boost::asio::io_service::id AccessLog::id;
+
+AccessLog::AccessLog(boost::asio::io_service& io_service)  // NOLINT
+    : boost::asio::io_service::service(io_service),
+      capacity_(0),
+      files_(0),
+      fd_(-1),
+      header_(NULL),
+      records_(NULL),
+      log(Logger::get_logger("puttle.access-log")) {
+}
+
+void AccessLog::shutdown_service() {
+    unmap_file();
+}
+
+void AccessLog::open(const Settings& settings, size_t index) {
+    path_ = settings.access_log + "." + boost::lexical_cast<std::string>(index);
+    capacity_ = std::max<size_t>((settings.access_log_size * 1024 * 1024 - sizeof(AccessLogHeader)) /
+                                 sizeof(AccessRecord), 1);
+    files_ = settings.access_log_files;
+
+    // Keep the log of the previous run
+    if (access(path_.c_str(), F_OK) == 0)
+        shift_files();
+
+    boost::system::error_code error = map_file();
+    if (error)
+        throw boost::system::system_error(error, path_);
+}
+
+void AccessLog::write(const AccessRecord& record) {
+    if (header_ == NULL)
+        return;
+
+    if (header_->count == capacity_) {
+        rotate();
+        if (header_ == NULL)
+            return;
+    }
+
+    records_[header_->count] = record;
+    ++header_->count;
+}
+
+boost::system::error_code AccessLog::map_file() {
+    size_t size = sizeof(AccessLogHeader) + capacity_ * sizeof(AccessRecord);
+
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd_ < 0)
+        return boost::system::error_code(errno, boost::system::system_category());
+
+    // Sparse until the records are written
+    void* data = MAP_FAILED;
+    if (ftruncate(fd_, size) == 0)
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+
+    if (data == MAP_FAILED) {
+        boost::system::error_code error(errno, boost::system::system_category());
+        ::close(fd_);
+        fd_ = -1;
+        return error;
+    }
+
+    header_ = static_cast<AccessLogHeader*>(data);
+    records_ = reinterpret_cast<AccessRecord*>(header_ + 1);
+    header_->init();
+    return boost::system::error_code();
+}
+
+void AccessLog::unmap_file() {
+    if (header_ == NULL)
+        return;
+
+    // Cut the unused records
+    size_t used = sizeof(AccessLogHeader) + header_->count * sizeof(AccessRecord);
+    munmap(header_, sizeof(AccessLogHeader) + capacity_ * sizeof(AccessRecord));
+    if (ftruncate(fd_, used) != 0)
+        log.warn("Unable to truncate %s: %s", path_.c_str(), strerror(errno));
+    ::close(fd_);
+
+    fd_ = -1;
+    header_ = NULL;
+    records_ = NULL;
+}
+
+void AccessLog::rotate() {
+    unmap_file();
+    shift_files();
+
+    boost::system::error_code error = map_file();
+    if (error)
+        log.error("Unable to open the access log %s, tunnels are no longer logged: %s",
+                  path_.c_str(), error.message().c_str());
+}
+
+void AccessLog::shift_files() {
+    for (size_t i = files_; i > 0; --i) {
+        std::string from = path_;
+        if (i > 1)
+            from += "." + boost::lexical_cast<std::string>(i - 1);
+        std::string to = path_ + "." + boost::lexical_cast<std::string>(i);
+
+        if (rename(from.c_str(), to.c_str()) != 0 && errno != ENOENT)
+            log.warn("Unable to rotate %s: %s", from.c_str(), strerror(errno));
+    }
+}
+}
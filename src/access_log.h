@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_ACCESS_LOG_H
+#define PUTTLE_SRC_ACCESS_LOG_H
+
+#include <puttle-common.h>
+#include <access_record.h>
+#include <logger.h>
+#include <settings.h>
+
+#include <string>
+
+namespace puttle {
+
+/* Binary log of the tunnels handled by an io_service.
+ *
+ * Each io_service appends fixed size records to its own memory-mapped
+ * file, `<Settings::access_log>.<index>`, so writing a record is a copy
+ * and no thread ever waits for another. When the file is full it is
+ * rotated to `.1`, `.2`... keeping Settings::access_log_files old files.
+ * Use puttle-logdump to read them.
+ */
+class AccessLog : public boost::asio::io_service::service {
+public:
+    static boost::asio::io_service::id id;
+
+    explicit AccessLog(boost::asio::io_service& io_service);  // NOLINT
+
+    static AccessLog& get(boost::asio::io_service& io_service) {  // NOLINT
+        return boost::asio::use_service<AccessLog>(io_service);
+    }
+
+    // Creates the file, before the io_service handles any tunnel.
+    // Throws a boost::system::system_error on failure.
+    void open(const Settings& settings, size_t index);
+
+    bool is_open() const {
+        return header_ != NULL;
+    }
+
+    void write(const AccessRecord& record);
+
+private:
+    void shutdown_service();
+
+    boost::system::error_code map_file();
+    void unmap_file();
+    void rotate();
+    void shift_files();
+
+    std::string path_;
+    size_t capacity_;  // Records per file
+    size_t files_;
+    int fd_;
+    AccessLogHeader* header_;
+    AccessRecord* records_;
+    Logger::Log log;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_ACCESS_LOG_H */
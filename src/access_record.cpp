@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <access_record.h>
+
+#include <cstring>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/format.hpp>
+
+namespace puttle {
+
+const char AccessLogHeader::MAGIC[8] = { 'P', 'U', 'T', 'T', 'L', 'E', 'A', 'L' };
+
+const char AccessRecord::CSV_HEADER[] =
+    "start,client,client_port,destination,destination_port,proxy,proxy_port,status,"
+    "bytes_up,bytes_down,setup_us,duration_us,reason";
+
+static const char* reason_names[AccessRecord::CLOSE_REASON_COUNT] = {
+    "unknown",
+    "client-closed",
+    "server-closed",
+    "relay-error",
+    "no-destination",
+    "no-proxy",
+    "proxy-error",
+    "proxy-refused",
+    "auth-failed"
+};
+
+void AccessLogHeader::init() {
+    memset(this, 0, sizeof(*this));
+    memcpy(magic, MAGIC, sizeof(magic));
+    version = VERSION;
+    record_size = sizeof(AccessRecord);
+}
+
+bool AccessLogHeader::is_valid() const {
+    return memcmp(magic, MAGIC, sizeof(magic)) == 0 && version == VERSION &&
+           record_size == sizeof(AccessRecord);
+}
+
+void AccessRecord::set_address(uint8_t* field, const boost::asio::ip::address& address) {
+    boost::asio::ip::address_v6::bytes_type bytes;
+    if (address.is_v4())
+        bytes = boost::asio::ip::address_v6::v4_mapped(address.to_v4()).to_bytes();
+    else
+        bytes = address.to_v6().to_bytes();
+    memcpy(field, bytes.data(), bytes.size());
+}
+
+boost::asio::ip::address AccessRecord::get_address(const uint8_t* field) {
+    boost::asio::ip::address_v6::bytes_type bytes;
+    memcpy(bytes.data(), field, bytes.size());
+
+    boost::asio::ip::address_v6 address(bytes);
+    if (address.is_v4_mapped())
+        return address.to_v4();
+    return address;
+}
+
+const char* AccessRecord::reason_name(uint8_t reason) {
+    if (reason >= CLOSE_REASON_COUNT)
+        return reason_names[CLOSE_UNKNOWN];
+    return reason_names[reason];
+}
+
+static std::string format_time(uint64_t microseconds) {
+    boost::posix_time::ptime t = boost::posix_time::from_time_t(microseconds / 1000000) +
+                                 boost::posix_time::microseconds(microseconds % 1000000);
+    return boost::posix_time::to_iso_extended_string(t);
+}
+
+static std::string format_endpoint(const uint8_t* address, uint16_t port) {
+    if (port == 0)
+        return "-";
+
+    boost::asio::ip::address a = AccessRecord::get_address(address);
+    if (a.is_v6())
+        return (boost::format("[%s]:%u") % a.to_string() % port).str();
+    return (boost::format("%s:%u") % a.to_string() % port).str();
+}
+
+std::string AccessRecord::str() const {
+    return (boost::format("%s %s -> %s via %s status %u up %u down %u setup %.3fms duration %.3fms %s")
+            % format_time(start)
+            % format_endpoint(client, client_port)
+            % format_endpoint(destination, destination_port)
+            % format_endpoint(proxy, proxy_port)
+            % status % bytes_up % bytes_down
+            % (setup / 1000.0) % (duration / 1000.0)
+            % reason_name(reason)).str();
+}
+
+std::string AccessRecord::csv() const {
+    return (boost::format("%s,%s,%u,%s,%u,%s,%u,%u,%u,%u,%u,%u,%s")
+            % format_time(start)
+            % get_address(client).to_string() % client_port
+            % get_address(destination).to_string() % destination_port
+            % (proxy_port == 0 ? std::string() : get_address(proxy).to_string()) % proxy_port
+            % status % bytes_up % bytes_down % setup % duration
+            % reason_name(reason)).str();
+}
+}
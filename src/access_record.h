@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_ACCESS_RECORD_H
+#define PUTTLE_SRC_ACCESS_RECORD_H
+
+#include <puttle-common.h>
+
+#include <string>
+
+#include <boost/static_assert.hpp>
+
+namespace puttle {
+
+/* Layout of the binary access log, shared by puttle and puttle-logdump.
+ *
+ * A file is an AccessLogHeader followed by `count` AccessRecords, one per
+ * tunnel, in the byte order of the machine which wrote them. Addresses
+ * are stored as IPv6 addresses, IPv4 ones being mapped.
+ */
+struct AccessLogHeader {
+    enum _CONSTANTS {
+        VERSION = 1
+    };
+
+    static const char MAGIC[8];
+
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;  // Records written so far
+    char reserved[40];
+
+    void init();
+    bool is_valid() const;
+};
+
+struct AccessRecord {
+    typedef enum {
+        CLOSE_UNKNOWN = 0,
+        CLOSE_CLIENT,          // The client ended the tunnel
+        CLOSE_SERVER,          // The destination (or the proxy) ended the tunnel
+        CLOSE_ERROR,           // I/O error while relaying
+        CLOSE_NO_DESTINATION,  // Original destination unavailable
+        CLOSE_NO_PROXY,        // No proxy could be reached
+        CLOSE_PROXY_ERROR,     // Proxy answer missing or invalid
+        CLOSE_PROXY_REFUSED,   // Proxy answered with an error status
+        CLOSE_AUTH,            // Unable to authenticate to the proxy
+        CLOSE_REASON_COUNT
+    } CloseReason;
+
+    uint64_t start;       // Accept time, in microseconds since the epoch
+    uint64_t duration;    // Microseconds from accept to close
+    uint64_t bytes_up;    // Client to destination
+    uint64_t bytes_down;  // Destination to client
+    uint32_t setup;       // Microseconds from accept to established tunnel, 0 if never
+    uint8_t client[16];
+    uint8_t destination[16];
+    uint8_t proxy[16];
+    uint16_t client_port;
+    uint16_t destination_port;
+    uint16_t proxy_port;
+    uint16_t status;      // Last status answered by the proxy
+    uint8_t reason;
+    uint8_t reserved[3];
+
+    static void set_address(uint8_t* field, const boost::asio::ip::address& address);
+    static boost::asio::ip::address get_address(const uint8_t* field);
+    static const char* reason_name(uint8_t reason);
+
+    static const char CSV_HEADER[];
+
+    // One line of text, without the final newline
+    std::string str() const;
+    std::string csv() const;
+};
+
+BOOST_STATIC_ASSERT(sizeof(AccessLogHeader) == 64);
+BOOST_STATIC_ASSERT(sizeof(AccessRecord) == 96);
+}
+
+#endif /* end of include guard: PUTTLE_SRC_ACCESS_RECORD_H */
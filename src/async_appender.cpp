@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <async_appender.h>
+
+#include <syslog.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+
+#include <boost/bind.hpp>
+
+namespace puttle {
+
+AsyncAppender::AsyncAppender(const std::string& name) :
+    log4cpp::LayoutAppender(name),
+    sleeping_(false),
+    ring_(&AsyncAppender::keep_ring),
+    stopped_(false),
+    dropped_(0) {
+    ::openlog("puttle", 0, LOG_USER);
+    writer_.reset(new boost::thread(boost::bind(&AsyncAppender::run, this)));
+}
+
+AsyncAppender::~AsyncAppender() {
+    close();
+}
+
+void AsyncAppender::close() {
+    if (stopped_.exchange(true))
+        return;
+
+    {
+        boost::mutex::scoped_lock lock(wake_mutex_);
+        wake_.notify_one();
+    }
+    writer_->join();
+    drain();
+    ::closelog();
+}
+
+uint64_t AsyncAppender::dropped() const {
+    return dropped_.load(boost::memory_order_relaxed);
+}
+
+AsyncAppender::Ring& AsyncAppender::ring() {
+    Ring* r = ring_.get();
+    if (r == NULL) {
+        r = new Ring();
+        boost::mutex::scoped_lock lock(rings_mutex_);
+        rings_.push_back(r);
+        ring_.reset(r);
+    }
+    return *r;
+}
+
+void AsyncAppender::_append(const log4cpp::LoggingEvent& event) {
+    Ring& r = ring();
+    size_t head = r.head.load(boost::memory_order_relaxed);
+    if (head - r.tail.load(boost::memory_order_acquire) == RING_SIZE) {
+        r.dropped.fetch_add(1, boost::memory_order_relaxed);
+        return;
+    }
+
+    std::string text = _getLayout().format(event);
+    Record& record = r.records[head % RING_SIZE];
+
+    // log4cpp priorities are syslog levels times 100
+    record.level = std::min<int>(event.priority / 100, LOG_DEBUG);
+    record.length = std::min<size_t>(text.size(), RECORD_SIZE);
+    memcpy(record.text, text.data(), record.length);
+    if (record.length == RECORD_SIZE)
+        record.text[RECORD_SIZE - 1] = '\n';
+
+    r.head.store(head + 1, boost::memory_order_release);
+    wake();
+}
+
+void AsyncAppender::wake() {
+    // Pairs with the fence of run(): either the writer sees the new record
+    // before sleeping, or this thread sees it sleeping
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    if (sleeping_.load(boost::memory_order_relaxed)) {
+        boost::mutex::scoped_lock lock(wake_mutex_);
+        wake_.notify_one();
+    }
+}
+
+void AsyncAppender::run() {
+    while (!stopped_.load(boost::memory_order_relaxed)) {
+        if (drain())
+            continue;
+
+        boost::mutex::scoped_lock lock(wake_mutex_);
+        sleeping_.store(true, boost::memory_order_relaxed);
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (!pending() && !stopped_.load(boost::memory_order_relaxed))
+            wake_.wait(lock);
+        sleeping_.store(false, boost::memory_order_relaxed);
+    }
+}
+
+// Rings are never freed before the appender, the copy stays valid
+void AsyncAppender::rings(std::vector<Ring*>* list) {
+    boost::mutex::scoped_lock lock(rings_mutex_);
+    list->clear();
+    for (boost::ptr_vector<Ring>::iterator it = rings_.begin(); it != rings_.end(); ++it)
+        list->push_back(&*it);
+}
+
+bool AsyncAppender::pending() {
+    std::vector<Ring*> list;
+    rings(&list);
+    for (std::vector<Ring*>::const_iterator it = list.begin(); it != list.end(); ++it) {
+        Ring& r = **it;
+        if (r.head.load(boost::memory_order_acquire) != r.tail.load(boost::memory_order_relaxed) ||
+                r.dropped.load(boost::memory_order_relaxed) > 0)
+            return true;
+    }
+    return false;
+}
+
+bool AsyncAppender::drain() {
+    bool written = false;
+
+    // The I/O happens without the lock, registering a thread never waits for it
+    std::vector<Ring*> list;
+    rings(&list);
+
+    for (std::vector<Ring*>::const_iterator it = list.begin(); it != list.end(); ++it) {
+        Ring& r = **it;
+        size_t tail = r.tail.load(boost::memory_order_relaxed);
+        size_t head = r.head.load(boost::memory_order_acquire);
+
+        for (; tail != head; ++tail) {
+            const Record& record = r.records[tail % RING_SIZE];
+            fwrite(record.text, 1, record.length, stdout);
+            syslog(record.level, "%.*s", static_cast<int>(record.length), record.text);
+            written = true;
+        }
+        r.tail.store(tail, boost::memory_order_release);
+
+        size_t dropped = r.dropped.exchange(0, boost::memory_order_relaxed);
+        if (dropped > 0) {
+            dropped_.fetch_add(dropped, boost::memory_order_relaxed);
+            fprintf(stdout, "WARN puttle.logger : %u log messages dropped\n", static_cast<unsigned>(dropped));
+            syslog(LOG_WARNING, "%u log messages dropped", static_cast<unsigned>(dropped));
+            written = true;
+        }
+    }
+
+    if (written)
+        fflush(stdout);
+    return written;
+}
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_ASYNC_APPENDER_H
+#define PUTTLE_SRC_ASYNC_APPENDER_H
+
+#include <puttle-common.h>
+
+#include <string>
+#include <vector>
+
+#include <log4cpp/LayoutAppender.hh>
+
+#include <boost/atomic.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace puttle {
+
+/* log4cpp appender which never blocks the logging thread.
+ *
+ * Events are formatted by the layout on the calling thread and copied
+ * into a ring of fixed size records owned by that thread: a single
+ * producer, single consumer queue without locks. A writer thread drains
+ * every ring to syslog and stdout, and sleeps on a condition variable once
+ * they are all empty: a logging thread only takes its mutex to wake it
+ * up. When a ring is full the record is
+ * dropped and counted, the writer then logs how many were lost.
+ * Records longer than RECORD_SIZE are truncated.
+ */
+class AsyncAppender : public log4cpp::LayoutAppender {
+public:
+    enum _CONSTANTS {
+        RECORD_SIZE = 512,
+        RING_SIZE = 256  // Records per thread
+    };
+
+    explicit AsyncAppender(const std::string& name);
+    virtual ~AsyncAppender();
+
+    // Writes what is left in the rings and stops the writer thread
+    virtual void close();
+
+    // Records dropped since the start
+    uint64_t dropped() const;
+
+protected:
+    virtual void _append(const log4cpp::LoggingEvent& event);
+
+private:
+    struct Record {
+        int level;  // syslog level
+        size_t length;
+        char text[RECORD_SIZE];
+    };
+
+    struct Ring {
+        Ring() : head(0), tail(0), dropped(0) {
+        }
+
+        Record records[RING_SIZE];
+        boost::atomic<size_t> head;  // Next record written by the owner thread
+        boost::atomic<size_t> tail;  // Next record read by the writer thread
+        boost::atomic<size_t> dropped;
+    };
+
+    static void keep_ring(Ring*) {
+        // Rings outlive their thread, the appender owns them
+    }
+
+    Ring& ring();
+    void wake();
+    void run();
+    bool drain();
+    bool pending();
+    void rings(std::vector<Ring*>* list);  // NOLINT
+
+    boost::mutex rings_mutex_;  // Only held to register a thread or copy the list
+    boost::ptr_vector<Ring> rings_;
+    boost::mutex wake_mutex_;
+    boost::condition_variable wake_;
+    boost::atomic<bool> sleeping_;  // The writer waits on wake_
+    boost::thread_specific_ptr<Ring> ring_;
+    boost::scoped_ptr<boost::thread> writer_;
+    boost::atomic<bool> stopped_;
+    boost::atomic<uint64_t> dropped_;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_ASYNC_APPENDER_H */
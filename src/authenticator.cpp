@@ -23,7 +23,6 @@
 #include <openssl/md5.h>
 
 #include <boost/assign.hpp>
-#include <boost/format.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/archive/iterators/base64_from_binary.hpp>
 #include <boost/archive/iterators/transform_width.hpp>
@@ -48,6 +47,7 @@ Authenticator::~Authenticator() {
 }
 
 Authenticator::nonce_rng Authenticator::rng;
+boost::mutex Authenticator::rng_mutex_;
 boost::once_flag Authenticator::init_rng_ = BOOST_ONCE_INIT;
 
 void Authenticator::init_rng() {
@@ -61,8 +61,9 @@ std::map<std::string, Authenticator::Method> Authenticator::method_names = boost
         ("None", Authenticator::AUTH_NONE);
 
 Authenticator::Method Authenticator::get_method(const std::string& method) {
-    if (method_names.count(method))
-        return method_names[method];
+    std::map<std::string, Method>::const_iterator it = method_names.find(method);
+    if (it != method_names.end())
+        return it->second;
     else
         return Authenticator::AUTH_INVALID;
 }
@@ -91,6 +92,10 @@ const Authenticator::headers_map& Authenticator::get_headers() {
 NoneAuthenticator::NoneAuthenticator() : Authenticator(Proxy::invalid_proxy) {
 }
 
+Authenticator::Method NoneAuthenticator::method() const {
+    return AUTH_NONE;
+}
+
 bool NoneAuthenticator::has_token() {
     return false;
 }
@@ -99,12 +104,25 @@ bool NoneAuthenticator::has_error() {
     return false;
 }
 
-std::string NoneAuthenticator::get_token() {
-    return std::string();
+const std::string& NoneAuthenticator::get_token() {
+    return token_;
 }
 
 
-BasicAuthenticator::BasicAuthenticator(const Proxy& proxy) : Authenticator(proxy), retries(2) {
+BasicAuthenticator::BasicAuthenticator(const Proxy& proxy) :
+    Authenticator(proxy),
+    retries(2),
+    token_(new std::string(make_token(proxy))) {
+}
+
+BasicAuthenticator::BasicAuthenticator(const Proxy& proxy, token_ptr token) :
+    Authenticator(proxy),
+    retries(2),
+    token_(token) {
+}
+
+Authenticator::Method BasicAuthenticator::method() const {
+    return AUTH_BASIC;
 }
 
 bool BasicAuthenticator::has_token() {
@@ -115,30 +133,40 @@ bool BasicAuthenticator::has_error() {
     return retries < 0;
 }
 
-std::string BasicAuthenticator::get_token() {
+const std::string& BasicAuthenticator::get_token() {
     --retries;
+    return *token_;
+}
 
-    boost::format cred_format("%s:%s");
-    cred_format % proxy_.username % proxy_.password;
-    std::string cred = cred_format.str();
+std::string BasicAuthenticator::make_token(const Proxy& proxy) {
+    std::string cred = proxy.username + ":" + proxy.password;
 
     std::string enc(base64_t(cred.begin()), base64_t(cred.end()));
-    enc.insert(enc.end(), enc.size() % 4, '=');
+    enc.insert(enc.end(), (4 - enc.size() % 4) % 4, '=');
 
-    boost::format fmt("Proxy-Authorization: Basic %s\r\n");
-    fmt % enc;
-
-    return fmt.str();
+    return "Proxy-Authorization: Basic " + enc + "\r\n";
 }
 
 DigestAuthenticator::DigestAuthenticator(const Proxy& proxy, const std::string& host, const std::string& port) :
     Authenticator(proxy),
     retries(5),
-    nonce_count_(0),
     host_(host),
     port_(port) {
 }
 
+DigestAuthenticator::DigestAuthenticator(const Proxy& proxy, const std::string& host, const std::string& port,
+                                         challenge_ptr challenge) :
+    Authenticator(proxy),
+    retries(5),
+    host_(host),
+    port_(port),
+    challenge_(challenge) {
+}
+
+Authenticator::Method DigestAuthenticator::method() const {
+    return AUTH_DIGEST;
+}
+
 bool DigestAuthenticator::has_token() {
     return retries >= 0;
 }
@@ -169,77 +197,73 @@ std::string DigestAuthenticator::to_hex(uint8_t* data, size_t len) {
 }
 
 std::string DigestAuthenticator::get_response() {
-    std::string ha1_hex;
-    std::string ha2_hex;
-
-    boost::format ha1_fmt("%s:%s:%s");
-    ha1_fmt % proxy_.username % realm_ % proxy_.password;
-    ha1_hex = get_md5(ha1_fmt.str());
+    // HA1 comes precomputed with the challenge
+    std::string ha2_hex = get_md5("CONNECT:" + host_ + ":" + port_);
 
-    boost::format ha2_fmt("%s:%s:%s");
-    ha2_fmt % "CONNECT" % host_ % port_;
-    ha2_hex = get_md5(ha2_fmt.str());
-
-    nc_ = boost::lexical_cast<std::string>(nonce_count_++);
+    nc_ = boost::lexical_cast<std::string>(challenge_->nonce_count++);
     nc_.insert(nc_.begin(), 8 - nc_.size(), '0');
 
     if (cnonce_.empty())
         cnonce_ = get_cnonce(16);
 
-    boost::format response_fmt("%s:%s:%s:%s:%s:%s");
-    response_fmt % ha1_hex
-    % nonce_
-    % nc_
-    % cnonce_
-    % qop_
-    % ha2_hex;
+    std::string response_data;
+    response_data.reserve(HASH_HEX_SIZE * 2 + challenge_->nonce.size() + cnonce_.size() + 32);
+    response_data += challenge_->ha1;
+    response_data += ':';
+    response_data += challenge_->nonce;
+    response_data += ':';
+    response_data += nc_;
+    response_data += ':';
+    response_data += cnonce_;
+    response_data += ':';
+    response_data += challenge_->qop;
+    response_data += ':';
+    response_data += ha2_hex;
 
-    std::string response_data = response_fmt.str();
     return get_md5(response_data);
 }
 
-std::string DigestAuthenticator::get_token() {
-    typedef std::map<std::string, std::string> string_map;
+static void append_param(std::string& header, const char* name, const std::string& value) {  // NOLINT
+    if (!value.empty()) {
+        header += name;
+        header += "=\"";
+        header += value;
+        header += "\", ";
+    }
+}
+
+const std::string& DigestAuthenticator::get_token() {
+    token_.clear();
+    if (!challenge_)
+        return token_;
 
-    string_map params;
-    std::string header;
+    std::string uri = host_ + ":" + port_;
     response_ = get_response();
 
     --retries;
 
-    // Build answer parameters
-    params["username"] = proxy_.username;
-    params["realm"] = realm_;
-    params["nonce"] = nonce_;
-    params["uri"] = host_ + ":" + port_;
-    params["response"] = response_;
-    params["qop"] = qop_;
-    params["cnonce"] = cnonce_;
-    params["opaque"] = opaque_;
-
+    // Answer parameters, in alphabetical order
+    std::string& header = token_;
     header = "Proxy-Authorization: Digest ";
-
-    for (string_map::const_iterator it = params.begin();
-            it != params.end(); it++) {
-        if (!(it->second.empty())) {
-            boost::format fmt("%s=\"%s\"%s");
-            fmt % it->first % it->second;
-            fmt % ", ";
-            header += fmt.str();
-        }
-    }
-
-    boost::format fmt("nc=%s");
-    fmt % nc_;
-    header += fmt.str();
+    append_param(header, "cnonce", cnonce_);
+    append_param(header, "nonce", challenge_->nonce);
+    append_param(header, "opaque", challenge_->opaque);
+    append_param(header, "qop", challenge_->qop);
+    append_param(header, "realm", challenge_->realm);
+    append_param(header, "response", response_);
+    append_param(header, "uri", uri);
+    append_param(header, "username", proxy_.username);
+
+    header += "nc=";
+    header += nc_;
     header += "\r\n";
 
-    return header;
+    return token_;
 }
 
-
-
 std::string DigestAuthenticator::get_cnonce(size_t len) {
+    boost::mutex::scoped_lock lock(rng_mutex_);
+
     const std::string characters("0123456789abcdef");
     boost::uniform_int<> dist(0, characters.size() - 1);
     boost::variate_generator<nonce_rng&, boost::uniform_int<> > urng(rng, dist);
@@ -253,15 +277,26 @@ std::string DigestAuthenticator::get_cnonce(size_t len) {
 void DigestAuthenticator::set_headers(const headers_map& headers) {
     Authenticator::set_headers(headers);
 
-    std::string method = headers_["Proxy-Authenticate"];
+    challenge_ptr challenge = parse_challenge(proxy_, headers_["Proxy-Authenticate"]);
 
-    qop_ = find_quoted("qop", method);
-    nonce_ = find_quoted("nonce", method);
-    realm_ = find_quoted("realm", method);
-    opaque_ = find_quoted("opaque", method);
+    // Keep sharing the nonce count if the proxy repeated a known challenge
+    if (!challenge_ || challenge_->nonce != challenge->nonce || challenge_->realm != challenge->realm)
+        challenge_ = challenge;
 
     cnonce_.erase();
-    // std::cout << method << std::endl;
+}
+
+DigestAuthenticator::challenge_ptr DigestAuthenticator::parse_challenge(const Proxy& proxy,
+        const std::string& header) {
+    challenge_ptr challenge(new Challenge());
+
+    challenge->qop = find_quoted("qop", header);
+    challenge->nonce = find_quoted("nonce", header);
+    challenge->realm = find_quoted("realm", header);
+    challenge->opaque = find_quoted("opaque", header);
+    challenge->ha1 = get_md5(proxy.username + ":" + challenge->realm + ":" + proxy.password);
+
+    return challenge;
 }
 
 std::string DigestAuthenticator::find_quoted(const std::string& name, const std::string& header) {
@@ -276,3 +311,53 @@ std::string DigestAuthenticator::find_quoted(const std::string& name, const std:
     }
 }
 }
+
+namespace puttle {
+
+Credentials::Credentials() :
+    method_(Authenticator::AUTH_NONE) {
+}
+
+void Credentials::learn(const Proxy& proxy, Authenticator::Method method, const headers_map& headers) {
+    headers_map::const_iterator it = headers.find("Proxy-Authenticate");
+    std::string header = (it != headers.end()) ? it->second : std::string();
+
+    // Done outside the lock, this is where the hashing happens
+    BasicAuthenticator::token_ptr basic_token;
+    DigestAuthenticator::challenge_ptr challenge;
+
+    switch (method) {
+    case Authenticator::AUTH_BASIC:
+        basic_token.reset(new std::string(BasicAuthenticator::make_token(proxy)));
+        break;
+    case Authenticator::AUTH_DIGEST:
+        challenge = DigestAuthenticator::parse_challenge(proxy, header);
+        break;
+    default:
+        return;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (method == Authenticator::AUTH_DIGEST && challenge_ && method_ == method &&
+            challenge_->nonce == challenge->nonce && challenge_->realm == challenge->realm)
+        return;
+
+    method_ = method;
+    basic_token_ = basic_token;
+    challenge_ = challenge;
+}
+
+Authenticator::pointer Credentials::authenticator(const Proxy& proxy, const std::string& host,
+        const std::string& port) {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    switch (method_) {
+    case Authenticator::AUTH_BASIC:
+        return Authenticator::pointer(new BasicAuthenticator(proxy, basic_token_));
+    case Authenticator::AUTH_DIGEST:
+        return Authenticator::pointer(new DigestAuthenticator(proxy, host, port, challenge_));
+    default:
+        return Authenticator::pointer();
+    }
+}
+}
@@ -27,8 +27,10 @@
 #include <map>
 #include <string>
 
+#include <boost/atomic.hpp>
 #include <boost/random.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/once.hpp>
 
 namespace puttle {
@@ -54,8 +56,10 @@ public:
     explicit Authenticator(const Proxy& proxy);
     virtual ~Authenticator();
 
+    virtual Method method() const = 0;
     virtual bool has_token() = 0;
-    virtual std::string get_token() = 0;
+    // The Proxy-Authorization header line, valid until the next call
+    virtual const std::string& get_token() = 0;
     virtual bool has_error() = 0;
     virtual void set_headers(const headers_map& headers);
     const headers_map& get_headers();
@@ -63,12 +67,15 @@ public:
 #ifdef HAVE_DEBUG
     // Used in unit tests
     inline static void reset_rng() {
+        boost::mutex::scoped_lock lock(rng_mutex_);
         rng.seed(0);
     }
 #endif
 
 protected:
+    // Shared by every thread, only used with rng_mutex_ held
     static nonce_rng rng;
+    static boost::mutex rng_mutex_;
     static boost::once_flag init_rng_;
     static void init_rng();
 
@@ -81,52 +88,109 @@ private:
 
 class BasicAuthenticator : public Authenticator {
 public:
+    typedef boost::shared_ptr<const std::string> token_ptr;
+
     explicit BasicAuthenticator(const Proxy& proxy);
+    BasicAuthenticator(const Proxy& proxy, token_ptr token);
+    virtual Method method() const;
     virtual bool has_token();
-    virtual std::string get_token();
+    virtual const std::string& get_token();
     virtual bool has_error();
 
+    // The whole "Proxy-Authorization: Basic ..." header line
+    static std::string make_token(const Proxy& proxy);
+
 private:
     int retries;
+    token_ptr token_;  // Shared with the Credentials of the proxy
 };
 
 class DigestAuthenticator : public Authenticator {
 public:
+    /* A Proxy-Authenticate challenge, with the HA1 of the proxy
+     * credentials already computed. Every request answering the same
+     * nonce, on any connection, takes the next nonce count.
+     */
+    struct Challenge {
+        Challenge() : nonce_count(0) {
+        }
+
+        std::string realm;
+        std::string qop;
+        std::string nonce;
+        std::string opaque;
+        std::string ha1;
+        boost::atomic<uint32_t> nonce_count;
+    };
+    typedef boost::shared_ptr<Challenge> challenge_ptr;
 
     DigestAuthenticator(const Proxy& proxy, const std::string& host, const std::string& port);
+    DigestAuthenticator(const Proxy& proxy, const std::string& host, const std::string& port,
+                        challenge_ptr challenge);
+    virtual Method method() const;
     virtual bool has_token();
-    virtual std::string get_token();
+    virtual const std::string& get_token();
     virtual bool has_error();
     virtual void set_headers(const headers_map& headers);
+
+    static challenge_ptr parse_challenge(const Proxy& proxy, const std::string& header);
+
+    // Lower case hex MD5 of `str`
+    static std::string get_md5(const std::string& str);
+    static std::string to_hex(uint8_t* data, size_t len);
+
 private:
-    std::string get_md5(const std::string& str);
+    static std::string find_quoted(const std::string& name, const std::string& header);
     std::string get_cnonce(size_t len);
     std::string get_response();
-    std::string to_hex(uint8_t* data, size_t len);
-    std::string find_quoted(const std::string& name, const std::string& header);
 
     int retries;
-    int nonce_count_;
     std::string nc_;
     std::string host_;
     std::string port_;
-    std::string realm_;
-    std::string qop_;
-    std::string nonce_;
     std::string cnonce_;
-    std::string opaque_;
     std::string response_;
+    std::string token_;
+    challenge_ptr challenge_;
 };
 
 class NoneAuthenticator : public Authenticator {
 public:
     NoneAuthenticator();
+    virtual Method method() const;
     virtual bool has_token();
-    virtual std::string get_token();
+    virtual const std::string& get_token();
     virtual bool has_error();
 
 private:
     int retries;
+    std::string token_;
+};
+
+/* What a proxy taught us about authenticating to it: the scheme and the
+ * last challenge it sent. Shared by every connection and thread using the
+ * proxy, so that new CONNECT requests carry Proxy-Authorization up front
+ * instead of waiting for a 407.
+ */
+class Credentials {
+public:
+    typedef std::map<std::string, std::string> headers_map;
+
+    Credentials();
+
+    // Remembers the challenge of a 407 answer from `proxy`
+    void learn(const Proxy& proxy, Authenticator::Method method, const headers_map& headers);
+
+    // An authenticator answering the last known challenge for host:port,
+    // or a null pointer if the proxy never asked for credentials.
+    Authenticator::pointer authenticator(const Proxy& proxy, const std::string& host,
+                                         const std::string& port);
+
+private:
+    boost::mutex mutex_;
+    Authenticator::Method method_;
+    BasicAuthenticator::token_ptr basic_token_;
+    DigestAuthenticator::challenge_ptr challenge_;
 };
 }
 
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <buffer_pool.h>
+
+#include <vector>
+
+namespace puttle {
+
+boost::asio::io_service::id BufferPool::id;
+
+BufferPool::BufferPool(boost::asio::io_service& io_service)  // NOLINT
+    : boost::asio::io_service::service(io_service),
+      budget_(MemoryBudget::get(io_service)),
+      in_use_(0),
+      cached_(0) {
+}
+
+BufferPool::~BufferPool() {
+    for (size_t i = 0; i < SIZE_CLASSES; ++i) {
+        for (size_t j = 0; j < free_[i].size(); ++j)
+            delete[] free_[i][j];
+    }
+}
+
+void BufferPool::shutdown_service() {
+}
+
+size_t BufferPool::size_class(size_t size) {
+    size_t c = 0;
+    for (size_t s = MIN_SIZE; s < size && c < SIZE_CLASSES - 1; s <<= 1)
+        ++c;
+    return c;
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t size) {
+    size_t c = size_class(size);
+    Buffer buffer;
+    buffer.size = static_cast<size_t>(MIN_SIZE) << c;
+
+    if (!free_[c].empty()) {
+        buffer.data = free_[c].back();
+        free_[c].pop_back();
+        cached_ -= buffer.size;
+    } else {
+        buffer.data = new char[buffer.size];
+    }
+
+    in_use_ += buffer.size;
+    budget_.charge(buffer.size);
+    return buffer;
+}
+
+void BufferPool::release(Buffer& buffer) {
+    if (buffer.data == NULL)
+        return;
+
+    size_t c = size_class(buffer.size);
+    in_use_ -= buffer.size;
+    budget_.credit(buffer.size);
+
+    if ((free_[c].size() + 1) * buffer.size <= MAX_CACHED_BYTES) {
+        free_[c].push_back(buffer.data);
+        cached_ += buffer.size;
+    } else {
+        delete[] buffer.data;
+    }
+
+    buffer = Buffer();
+}
+
+size_t BufferPool::in_use() const {
+    return in_use_;
+}
+
+size_t BufferPool::cached() const {
+    return cached_;
+}
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_BUFFER_POOL_H
+#define PUTTLE_SRC_BUFFER_POOL_H
+
+#include <puttle-common.h>
+#include <memory_budget.h>
+
+#include <vector>
+
+namespace puttle {
+
+/* Relay buffers shared by all the connections of an io_service.
+ *
+ * Buffers come in power of two size classes, from MIN_SIZE to MAX_SIZE,
+ * and released buffers are kept on a free list per class. Each io_service
+ * is run by a single thread, and connections only acquire or release
+ * buffers from their own handlers, so the free lists need no locking.
+ * Buffers in use are charged to the MemoryBudget of the io_service.
+ */
+class BufferPool : public boost::asio::io_service::service {
+public:
+    enum _CONSTANTS {
+        MIN_SIZE = 4096,
+        MAX_SIZE = 262144,
+        SIZE_CLASSES = 7,          // 4 KiB .. 256 KiB
+        MAX_CACHED_BYTES = 1048576  // Per size class
+    };
+
+    struct Buffer {
+        Buffer() : data(NULL), size(0) {
+        }
+
+        char* data;
+        size_t size;
+    };
+
+    static boost::asio::io_service::id id;
+
+    explicit BufferPool(boost::asio::io_service& io_service);  // NOLINT
+    ~BufferPool();
+
+    static BufferPool& get(boost::asio::io_service& io_service) {  // NOLINT
+        return boost::asio::use_service<BufferPool>(io_service);
+    }
+
+    // Returns a buffer of at least `size` bytes (clamped to MAX_SIZE)
+    Buffer acquire(size_t size);
+    // Gives the buffer back to the pool and resets it
+    void release(Buffer& buffer);  // NOLINT
+
+    size_t in_use() const;
+    size_t cached() const;
+
+private:
+    void shutdown_service();
+    static size_t size_class(size_t size);
+
+    MemoryBudget& budget_;
+    std::vector<char*> free_[SIZE_CLASSES];
+    size_t in_use_;
+    size_t cached_;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_BUFFER_POOL_H */
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <circuit_breaker.h>
+
+namespace puttle {
+
+CircuitBreaker::CircuitBreaker() :
+    threshold_(0),
+    cooldown_(0),
+    state_(CLOSED),
+    failures_(0) {
+}
+
+void CircuitBreaker::configure(size_t threshold, long cooldown) {
+    boost::mutex::scoped_lock lock(mutex_);
+    threshold_ = threshold;
+    cooldown_ = cooldown;
+}
+
+bool CircuitBreaker::available() {
+    boost::mutex::scoped_lock lock(mutex_);
+    return state_ == CLOSED || now() >= retry_at_;
+}
+
+bool CircuitBreaker::allow() {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (state_ == CLOSED)
+        return true;
+
+    boost::posix_time::ptime t = now();
+    if (t < retry_at_)
+        return false;
+
+    state_ = HALF_OPEN;
+    retry_at_ = t + boost::posix_time::seconds(static_cast<long>(PROBE_INTERVAL));
+    return true;
+}
+
+void CircuitBreaker::record_success() {
+    boost::mutex::scoped_lock lock(mutex_);
+    state_ = CLOSED;
+    failures_ = 0;
+}
+
+void CircuitBreaker::record_failure() {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (threshold_ == 0)
+        return;
+
+    if (state_ == HALF_OPEN) {
+        // The probe failed
+        open(now());
+    } else if (state_ == CLOSED && ++failures_ >= threshold_) {
+        open(now());
+    }
+}
+
+CircuitBreaker::State CircuitBreaker::state() {
+    boost::mutex::scoped_lock lock(mutex_);
+    return state_;
+}
+
+void CircuitBreaker::open(boost::posix_time::ptime t) {
+    state_ = OPEN;
+    failures_ = 0;
+    retry_at_ = t + boost::posix_time::seconds(cooldown_);
+}
+
+boost::posix_time::ptime CircuitBreaker::now() {
+    return boost::posix_time::microsec_clock::universal_time();
+}
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_CIRCUIT_BREAKER_H
+#define PUTTLE_SRC_CIRCUIT_BREAKER_H
+
+#include <puttle-common.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace puttle {
+
+/* Health of one proxy, shared by every connection of the process.
+ *
+ * CLOSED: tunnels use the proxy, `threshold` consecutive failures open
+ * the breaker. OPEN: new tunnels skip the proxy for `cooldown` seconds.
+ * HALF_OPEN: once the cooldown is over, one probe tunnel per
+ * PROBE_INTERVAL is let through; a success closes the breaker, a failure
+ * opens it for another cooldown. A threshold of 0 disables the breaker.
+ */
+class CircuitBreaker {
+public:
+    typedef enum {
+        CLOSED,
+        OPEN,
+        HALF_OPEN,
+    } State;
+
+    enum _CONSTANTS {
+        PROBE_INTERVAL = 1  // Seconds between probes of a half-open breaker
+    };
+
+    CircuitBreaker();
+
+    void configure(size_t threshold, long cooldown);
+
+    // Whether a new tunnel may consider the proxy, never claims the probe
+    bool available();
+
+    // Whether a connection to the proxy may be attempted now, may claim
+    // the probe: only call it right before actually trying the proxy
+    bool allow();
+
+    void record_success();
+    void record_failure();
+
+    State state();
+
+private:
+    void open(boost::posix_time::ptime t);
+
+    static boost::posix_time::ptime now();
+
+    boost::mutex mutex_;
+    size_t threshold_;
+    long cooldown_;
+    State state_;
+    size_t failures_;  // Consecutive failures while closed
+    boost::posix_time::ptime retry_at_;  // Next probe once open or half-open
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_CIRCUIT_BREAKER_H */
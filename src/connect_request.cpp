@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <connect_request.h>
+
+#include <cstring>
+#include <string>
+
+namespace puttle {
+
+namespace {
+
+// Writes `value` in decimal at `out`, returns the number of digits
+size_t format_uint(char* out, uint32_t value) {
+    char digits[10];
+    size_t n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    for (size_t i = 0; i < n; ++i)
+        out[i] = digits[n - 1 - i];
+    return n;
+}
+
+size_t append(char* out, const char* s) {
+    size_t n = strlen(s);
+    memcpy(out, s, n);
+    return n;
+}
+}
+
+const char ConnectRequest::HEADERS[] =
+    "User-Agent: Mozilla/5.0 (X11; U; AmigaOS x86_64; eo-EO; rv:42.6.6)\r\n"
+    "Proxy-Connection: keep-alive\r\n";
+
+const char ConnectRequest::END[] = "\r\n";
+
+ConnectRequest::ConnectRequest() :
+    request_line_size_(0),
+    host_line_size_(0) {
+}
+
+void ConnectRequest::set_destination(uint32_t ip, uint16_t port) {
+    // host:port, formatted once in the request line
+    char* p = request_line_;
+    p += append(p, "CONNECT ");
+
+    const char* host = p;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        p += format_uint(p, (ip >> shift) & 0xff);
+        if (shift > 0)
+            *p++ = '.';
+    }
+    size_t host_size = p - host;
+    *p++ = ':';
+
+    const char* port_digits = p;
+    p += format_uint(p, port);
+    size_t port_size = p - port_digits;
+    size_t authority = p - host;
+
+    p += append(p, " HTTP/1.1\r\n");
+    request_line_size_ = p - request_line_;
+
+    host_ = Slice(host, host_size);
+    port_ = Slice(port_digits, port_size);
+
+    p = host_line_;
+    p += append(p, "Host: ");
+    memcpy(p, host, authority);
+    p += authority;
+    p += append(p, END);
+    host_line_size_ = p - host_line_;
+}
+
+Slice ConnectRequest::host() const {
+    return host_;
+}
+
+Slice ConnectRequest::port() const {
+    return port_;
+}
+
+ConnectRequest::buffers_type ConnectRequest::buffers(const std::string& authorization) const {
+    buffers_type buffers = {{
+            boost::asio::buffer(request_line_, request_line_size_),
+            boost::asio::buffer(HEADERS, sizeof(HEADERS) - 1),
+            boost::asio::buffer(host_line_, host_line_size_),
+            boost::asio::buffer(authorization),
+            boost::asio::buffer(END, sizeof(END) - 1)
+        }
+    };
+    return buffers;
+}
+
+std::string ConnectRequest::str(const std::string& authorization) const {
+    std::string request;
+    buffers_type b = buffers(authorization);
+    for (size_t i = 0; i < b.size(); ++i)
+        request.append(boost::asio::buffer_cast<const char*>(b[i]), boost::asio::buffer_size(b[i]));
+    return request;
+}
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_CONNECT_REQUEST_H
+#define PUTTLE_SRC_CONNECT_REQUEST_H
+
+#include <puttle-common.h>
+#include <http_parser.h>
+
+#include <string>
+
+#include <boost/array.hpp>
+
+namespace puttle {
+
+/* The CONNECT request of a tunnel, built without allocating.
+ *
+ * Only the request and Host lines depend on the destination, they are
+ * formatted once into fixed buffers. The other headers are a static block
+ * and the Proxy-Authorization line is the one the authenticator keeps, so
+ * the request goes out as a single gather write of those pieces.
+ */
+class ConnectRequest {
+public:
+    enum _CONSTANTS {
+        MAX_LINE = 64,  // Enough for "CONNECT 255.255.255.255:65535 HTTP/1.1\r\n"
+        BUFFER_COUNT = 5
+    };
+
+    typedef boost::array<boost::asio::const_buffer, BUFFER_COUNT> buffers_type;
+
+    ConnectRequest();
+
+    // IPv4 address and port in host byte order
+    void set_destination(uint32_t ip, uint16_t port);
+
+    Slice host() const;
+    Slice port() const;
+
+    // The whole request, `authorization` being empty or a complete header line
+    buffers_type buffers(const std::string& authorization) const;
+
+    std::string str(const std::string& authorization) const;
+
+private:
+    static const char HEADERS[];
+    static const char END[];
+
+    char request_line_[MAX_LINE];
+    size_t request_line_size_;
+    char host_line_[MAX_LINE];
+    size_t host_line_size_;
+    Slice host_;
+    Slice port_;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_CONNECT_REQUEST_H */
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <connector.h>
+#include <socket_options.h>
+#include <resolve_cache.h>
+#include <proxy_selection.h>
+#include <circuit_breaker.h>
+
+#include <vector>
+
+namespace puttle {
+
+Connector::Connector(boost::asio::io_service& io_service,  // NOLINT
+                     const proxy_vector& proxies, const Settings& settings)
+    : io_service_(io_service),
+      metrics_(Metrics::get(io_service)),
+      proxies_(proxies),
+      settings_(settings),
+      timer_(io_service),
+      candidates_(proxies.size()),
+      current_(0),
+      pending_(0),
+      waiting_(true),
+      done_(false),
+      log(Logger::get_logger("puttle.connector")) {
+}
+
+void Connector::start(handler h) {
+    handler_ = h;
+
+    if (proxies_.empty()) {
+        io_service_.post(boost::bind(&Connector::finish, shared_from_this(),
+                                     boost::asio::error::host_not_found, 0, socket_ptr(), false));
+        return;
+    }
+
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < proxies_.size(); ++i) {
+        candidates_[i].started = now;
+        log.debug("Resolving %s:%u", proxies_[i]->host.c_str(), proxies_[i]->port);
+        ResolveCache::instance().async_resolve(io_service_, proxies_[i]->host, proxies_[i]->port,
+                                               boost::bind(&Connector::handle_resolve, shared_from_this(),
+                                                       i, _1, _2));
+    }
+}
+
+void Connector::handle_resolve(size_t candidate, const boost::system::error_code& error,
+                               tcp::resolver::iterator endpoint_iterator) {
+    Candidate& c = candidates_[candidate];
+    c.resolved = true;
+
+    Metrics::ProxyMetrics& metrics = metrics_.proxy(*proxies_[candidate]);
+    metrics.resolve.record((boost::posix_time::microsec_clock::universal_time() - c.started)
+                           .total_microseconds());
+
+    if (!error) {
+        // Alternate the address families, the first one as the resolver sorted them
+        std::vector<tcp::endpoint> first, second;
+        for (tcp::resolver::iterator end; endpoint_iterator != end; ++endpoint_iterator) {
+            tcp::endpoint endpoint = *endpoint_iterator;
+            if (first.empty() || endpoint.protocol() == first.front().protocol())
+                first.push_back(endpoint);
+            else
+                second.push_back(endpoint);
+        }
+        for (size_t i = 0; i < first.size() || i < second.size(); ++i) {
+            if (i < first.size())
+                c.endpoints.push_back(first[i]);
+            if (i < second.size())
+                c.endpoints.push_back(second[i]);
+        }
+    } else {
+        metrics.resolve_failures.add();
+        log.error("Unable to resolve: %s:%u, skipping",
+                  proxies_[candidate]->host.c_str(), proxies_[candidate]->port);
+    }
+
+    if (done_)
+        return;
+
+    if (waiting_)
+        start_attempt();
+}
+
+bool Connector::next_endpoint(size_t* candidate, tcp::endpoint* endpoint) {
+    // Proxies are tried in order, a proxy not resolved yet holds back the next ones
+    while (current_ < candidates_.size() && candidates_[current_].resolved) {
+        Candidate& c = candidates_[current_];
+        // Claim the probe of a half-open breaker only when the proxy is tried
+        if (c.next == 0 && !c.endpoints.empty() && !proxies_[current_]->breaker->allow()) {
+            log.debug("Skipping %s:%u, its circuit breaker is open",
+                      proxies_[current_]->host.c_str(), proxies_[current_]->port);
+            c.next = c.endpoints.size();
+        }
+        if (c.next < c.endpoints.size()) {
+            *candidate = current_;
+            *endpoint = c.endpoints[c.next++];
+            return true;
+        }
+        ++current_;
+    }
+    return false;
+}
+
+void Connector::start_attempt() {
+    size_t candidate;
+    tcp::endpoint endpoint;
+
+    while (next_endpoint(&candidate, &endpoint)) {
+        socket_ptr socket(new tcp::socket(io_service_));
+        try {
+            open_upstream_socket(*socket, endpoint.protocol(), settings_.upstream_socket);
+        } catch(const boost::system::system_error &e) {
+            log.errorStream() << "Could not open a socket: " << e.what();
+            continue;
+        }
+
+        bool fast_open = false;
+        if (settings_.fast_open) {
+            boost::system::error_code error = enable_fast_open(*socket);
+            if (error)
+                log.debug("TCP Fast Open unavailable, connecting normally: %s", error.message().c_str());
+            fast_open = !error;
+        }
+
+        log.debugStream() << "Connecting to " << proxies_[candidate]->host << " at " << endpoint;
+        attempts_.push_back(Attempt(candidate, socket,
+                                    boost::posix_time::microsec_clock::universal_time(), fast_open));
+        ++pending_;
+        waiting_ = false;
+        socket->async_connect(endpoint,
+                              boost::bind(&Connector::handle_connect, shared_from_this(),
+                                          attempts_.size() - 1, boost::asio::placeholders::error));
+        schedule_stagger();
+        return;
+    }
+
+    waiting_ = true;
+    check_failed();
+}
+
+void Connector::schedule_stagger() {
+    if (settings_.connect_stagger <= 0)
+        return;
+
+    timer_.expires_from_now(boost::posix_time::milliseconds(settings_.connect_stagger));
+    timer_.async_wait(boost::bind(&Connector::handle_stagger, shared_from_this(),
+                                  boost::asio::placeholders::error));
+}
+
+void Connector::handle_stagger(const boost::system::error_code& error) {
+    if (error || done_)
+        return;
+
+    start_attempt();
+}
+
+void Connector::handle_connect(size_t attempt, const boost::system::error_code& error) {
+    --pending_;
+    if (done_)
+        return;
+
+    Attempt& a = attempts_[attempt];
+    ProxyStats& stats = *proxies_[a.candidate]->stats;
+    Metrics::ProxyMetrics& metrics = metrics_.proxy(*proxies_[a.candidate]);
+    if (!error) {
+        // A fast open connection is not established yet, the CONNECT
+        // response latency accounts for the handshake instead
+        if (!a.fast_open) {
+            uint64_t micros = (boost::posix_time::microsec_clock::universal_time() - a.started)
+                              .total_microseconds();
+            stats.record_connect(micros);
+            metrics.connect.record(micros);
+        }
+        finish(error, a.candidate, a.socket, a.fast_open);
+        return;
+    }
+
+    stats.record_failure();
+    metrics.connect_failures.add();
+    proxies_[a.candidate]->breaker->record_failure();
+    log.debugStream() << "Unable to connect to " << proxies_[a.candidate]->host << ": " << error.message();
+    a.socket->close();
+
+    // Do not wait for the stagger delay, a failure frees the slot right away
+    start_attempt();
+}
+
+void Connector::check_failed() {
+    if (pending_ > 0)
+        return;
+
+    for (size_t i = current_; i < candidates_.size(); ++i) {
+        if (!candidates_[i].resolved)
+            return;
+    }
+
+    finish(boost::asio::error::host_unreachable, 0, socket_ptr(), false);
+}
+
+void Connector::finish(const boost::system::error_code& error, size_t candidate, socket_ptr socket,
+                       bool fast_open) {
+    if (done_)
+        return;
+    done_ = true;
+    timer_.cancel();
+
+    // The losers are aborted, their handlers only see done_. Being slower
+    // than another attempt is no failure: only the attempts which failed
+    // were counted against their proxy, in handle_connect()
+    for (size_t i = 0; i < attempts_.size(); ++i) {
+        Attempt& a = attempts_[i];
+        if (a.socket == socket || !a.socket->is_open())
+            continue;
+
+        boost::system::error_code ignored;
+        a.socket->close(ignored);
+    }
+
+    handler h;
+    h.swap(handler_);
+    h(error, candidate, socket, fast_open);
+}
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_CONNECTOR_H
+#define PUTTLE_SRC_CONNECTOR_H
+
+#include <puttle-common.h>
+#include <logger.h>
+#include <metrics.h>
+#include <proxy.h>
+#include <settings.h>
+
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace puttle {
+
+using boost::asio::ip::tcp;
+
+/* Races connections to a list of proxies, Happy Eyeballs style.
+ *
+ * Every proxy is resolved up front. Their endpoints are then tried in
+ * order, proxy after proxy, alternating address families within a proxy.
+ * The next attempt starts as soon as the previous one fails or after
+ * `stagger` milliseconds without an answer, whichever comes first, and
+ * the first established connection wins: the other attempts are closed.
+ * A stagger of 0 waits for each attempt to fail before the next one.
+ * The stagger and the socket profile come from the settings.
+ *
+ * With Settings::fast_open the sockets use TCP Fast Open: they connect at
+ * once and the first attempt always wins, the caller has to treat a
+ * connection failing before the proxy answered as a connect failure.
+ *
+ * The handler gets the index of the winning proxy, its socket and whether
+ * that socket uses Fast Open, or an error once every attempt failed. A connector is only used from the
+ * thread running its io_service and keeps itself alive until then.
+ */
+class Connector : public boost::enable_shared_from_this<Connector> {
+public:
+    typedef boost::shared_ptr<Connector> pointer;
+    typedef boost::shared_ptr<tcp::socket> socket_ptr;
+    typedef boost::function<void (const boost::system::error_code&, size_t, socket_ptr, bool)> handler;
+
+    static pointer create(boost::asio::io_service& io_service,  // NOLINT
+                          const proxy_vector& proxies, const Settings& settings) {
+        return pointer(new Connector(io_service, proxies, settings));
+    }
+
+    void start(handler h);
+
+private:
+    struct Candidate {
+        Candidate() : resolved(false), next(0) {
+        }
+
+        boost::posix_time::ptime started;  // Of the resolution
+        bool resolved;
+        std::vector<tcp::endpoint> endpoints;
+        size_t next;  // Next endpoint to try
+    };
+
+    struct Attempt {
+        Attempt(size_t candidate_, socket_ptr socket_, boost::posix_time::ptime started_, bool fast_open_) :
+            candidate(candidate_), socket(socket_), started(started_), fast_open(fast_open_) {
+        }
+
+        size_t candidate;
+        socket_ptr socket;
+        boost::posix_time::ptime started;
+        bool fast_open;  // Connects at once, the handshake waits for the first write
+    };
+
+    Connector(boost::asio::io_service& io_service,  // NOLINT
+              const proxy_vector& proxies, const Settings& settings);
+
+    bool next_endpoint(size_t* candidate, tcp::endpoint* endpoint);
+    void start_attempt();
+    void schedule_stagger();
+    void check_failed();
+    void finish(const boost::system::error_code& error, size_t candidate, socket_ptr socket, bool fast_open);
+
+    void handle_resolve(size_t candidate, const boost::system::error_code& error,
+                        tcp::resolver::iterator endpoint_iterator);
+    void handle_connect(size_t attempt, const boost::system::error_code& error);
+    void handle_stagger(const boost::system::error_code& error);
+
+    boost::asio::io_service& io_service_;
+    Metrics& metrics_;
+    proxy_vector proxies_;
+    const Settings& settings_;
+    handler handler_;
+    boost::asio::deadline_timer timer_;
+    std::vector<Candidate> candidates_;
+    size_t current_;  // First candidate which may still have endpoints to try
+    std::vector<Attempt> attempts_;
+    size_t pending_;  // Attempts still connecting
+    bool waiting_;    // An attempt is due as soon as a proxy is resolved
+    bool done_;
+    Logger::Log log;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_CONNECTOR_H */
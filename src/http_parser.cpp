@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <http_parser.h>
+
+#include <cstring>
+#include <algorithm>
+#include <string>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/find.hpp>
+#include <boost/range/iterator_range.hpp>
+
+namespace puttle {
+
+namespace {
+
+bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+Slice trim(Slice s) {
+    while (s.size > 0 && is_space(s.data[0])) {
+        ++s.data;
+        --s.size;
+    }
+    while (s.size > 0 && is_space(s.data[s.size - 1]))
+        --s.size;
+    return s;
+}
+
+// Parses the digits at the start of `s`, returns how many there were
+size_t parse_digits(const Slice& s, int* value) {
+    size_t i = 0;
+    *value = 0;
+    while (i < s.size && i < 9 && isdigit(s.data[i]))
+        *value = *value * 10 + (s.data[i++] - '0');
+    return i;
+}
+}
+
+std::string Slice::str() const {
+    return std::string(data, size);
+}
+
+bool Slice::iequals(const char* s) const {
+    return boost::algorithm::iequals(boost::make_iterator_range(data, data + size), s);
+}
+
+bool Slice::icontains(const char* s) const {
+    boost::iterator_range<const char*> range(data, data + size);
+    return !boost::algorithm::ifind_first(range, s).empty();
+}
+
+bool Slice::to_uint64(uint64_t* value) const {
+    Slice s = trim(*this);
+    if (s.size == 0 || s.size > 19)
+        return false;
+
+    *value = 0;
+    for (size_t i = 0; i < s.size; ++i) {
+        if (!isdigit(s.data[i]))
+            return false;
+        *value = *value * 10 + (s.data[i] - '0');
+    }
+    return true;
+}
+
+ResponseParser::ResponseParser() {
+    reset();
+}
+
+void ResponseParser::reset() {
+    result_ = INCOMPLETE;
+    scanned_ = 0;
+    line_start_ = 0;
+    status_ = 0;
+    version_major_ = 0;
+    version_minor_ = 0;
+    status_line_ = Slice();
+    header_count_ = 0;
+}
+
+ResponseParser::Result ResponseParser::parse(const char* data, size_t size) {
+    while (result_ == INCOMPLETE && scanned_ < size) {
+        const char* end = static_cast<const char*>(memchr(data + scanned_, '\n', size - scanned_));
+        if (end == NULL) {
+            scanned_ = size;
+            break;
+        }
+
+        Slice line(data + line_start_, end - (data + line_start_));
+        if (line.size > 0 && line.data[line.size - 1] == '\r')
+            --line.size;
+
+        scanned_ = line_start_ = end - data + 1;
+
+        if (status_line_.data == NULL) {
+            if (!parse_status_line(line))
+                result_ = INVALID;
+        } else if (line.size == 0) {
+            result_ = COMPLETE;
+        } else {
+            parse_header_line(line);
+        }
+    }
+
+    return result_;
+}
+
+bool ResponseParser::parse_status_line(Slice line) {
+    // HTTP/<major>.<minor> <status>[ <reason>]
+    status_line_ = line;
+    if (line.size < 12 || memcmp(line.data, "HTTP/", 5) != 0)
+        return false;
+
+    Slice s(line.data + 5, line.size - 5);
+    size_t n = parse_digits(s, &version_major_);
+    if (n == 0 || n >= s.size || s.data[n] != '.')
+        return false;
+
+    s = Slice(s.data + n + 1, s.size - n - 1);
+    n = parse_digits(s, &version_minor_);
+    if (n == 0 || n >= s.size || !is_space(s.data[n]))
+        return false;
+
+    s = trim(Slice(s.data + n, s.size - n));
+    n = parse_digits(s, &status_);
+    return n == 3 && (n == s.size || is_space(s.data[n]));
+}
+
+void ResponseParser::parse_header_line(Slice line) {
+    const char* colon = static_cast<const char*>(memchr(line.data, ':', line.size));
+    if (colon == NULL || header_count_ == MAX_HEADERS)
+        return;
+
+    Header& h = headers_[header_count_++];
+    h.name = trim(Slice(line.data, colon - line.data));
+    h.value = trim(Slice(colon + 1, line.data + line.size - colon - 1));
+}
+
+int ResponseParser::status() const {
+    return status_;
+}
+
+int ResponseParser::version_major() const {
+    return version_major_;
+}
+
+int ResponseParser::version_minor() const {
+    return version_minor_;
+}
+
+Slice ResponseParser::status_line() const {
+    return status_line_;
+}
+
+size_t ResponseParser::header_count() const {
+    return header_count_;
+}
+
+const ResponseParser::Header& ResponseParser::header(size_t i) const {
+    return headers_[i];
+}
+
+const Slice* ResponseParser::find(const char* name) const {
+    for (size_t i = 0; i < header_count_; ++i) {
+        if (headers_[i].name.iequals(name))
+            return &headers_[i].value;
+    }
+    return NULL;
+}
+
+size_t ResponseParser::size() const {
+    return line_start_;
+}
+
+BodyDrain::BodyDrain() :
+    state_(DONE),
+    remaining_(0),
+    digits_(0),
+    limit_(0),
+    consumed_(0) {
+}
+
+void BodyDrain::reset_length(uint64_t length) {
+    state_ = length > 0 ? LENGTH : DONE;
+    remaining_ = length;
+}
+
+void BodyDrain::reset_chunked(uint64_t limit) {
+    state_ = CHUNK_SIZE;
+    remaining_ = 0;
+    digits_ = 0;
+    limit_ = limit;
+    consumed_ = 0;
+}
+
+bool BodyDrain::done() const {
+    return state_ == DONE;
+}
+
+bool BodyDrain::failed() const {
+    return state_ == FAILED;
+}
+
+void BodyDrain::end_size_line() {
+    state_ = (remaining_ == 0) ? TRAILER_START : CHUNK_DATA;
+}
+
+size_t BodyDrain::consume(const char* data, size_t size) {
+    size_t i = 0;
+
+    while (i < size && state_ != DONE && state_ != FAILED) {
+        if (state_ == LENGTH || state_ == CHUNK_DATA) {
+            // Skip the payload in one go
+            size_t n = static_cast<size_t>(std::min<uint64_t>(remaining_, size - i));
+            remaining_ -= n;
+            i += n;
+            if (remaining_ == 0)
+                state_ = (state_ == LENGTH) ? DONE : CHUNK_DATA_CR;
+            continue;
+        }
+
+        char c = data[i++];
+        switch (state_) {
+        case CHUNK_SIZE:
+            if (isxdigit(c) && digits_ < MAX_SIZE_DIGITS) {
+                remaining_ = remaining_ * 16 + (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+                ++digits_;
+            } else if (digits_ > 0 && (c == ';' || c == ' ' || c == '\t')) {
+                state_ = CHUNK_EXTENSION;
+            } else if (digits_ > 0 && c == '\r') {
+                state_ = CHUNK_SIZE_LF;
+            } else if (digits_ > 0 && c == '\n') {
+                end_size_line();
+            } else {
+                state_ = FAILED;
+            }
+            break;
+        case CHUNK_EXTENSION:
+            if (c == '\r')
+                state_ = CHUNK_SIZE_LF;
+            else if (c == '\n')
+                end_size_line();
+            break;
+        case CHUNK_SIZE_LF:
+            if (c == '\n')
+                end_size_line();
+            else
+                state_ = FAILED;
+            break;
+        case CHUNK_DATA_CR:
+            if (c == '\r') {
+                state_ = CHUNK_DATA_LF;
+                break;
+            }
+            // Fall through, tolerate bare LF line endings
+        case CHUNK_DATA_LF:
+            if (c == '\n') {
+                state_ = CHUNK_SIZE;
+                digits_ = 0;
+            } else {
+                state_ = FAILED;
+            }
+            break;
+        case TRAILER_START:
+            if (c == '\r')
+                state_ = FINAL_LF;
+            else if (c == '\n')
+                state_ = DONE;
+            else
+                state_ = TRAILER_LINE;
+            break;
+        case TRAILER_LINE:
+            if (c == '\n')
+                state_ = TRAILER_START;
+            break;
+        case FINAL_LF:
+            state_ = (c == '\n') ? DONE : FAILED;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // A chunked body has no announced size, bound what is skipped
+    if (state_ != LENGTH && state_ != DONE && state_ != FAILED) {
+        consumed_ += i;
+        if (consumed_ > limit_)
+            state_ = FAILED;
+    }
+
+    return i;
+}
+}
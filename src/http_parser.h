@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_HTTP_PARSER_H
+#define PUTTLE_SRC_HTTP_PARSER_H
+
+#include <puttle-common.h>
+
+#include <string>
+
+namespace puttle {
+
+/* Read-only view of bytes owned by someone else, usually a receive buffer */
+struct Slice {
+    Slice() : data(NULL), size(0) {
+    }
+
+    Slice(const char* data_, size_t size_) : data(data_), size(size_) {
+    }
+
+    std::string str() const;
+    bool iequals(const char* s) const;
+    bool icontains(const char* s) const;
+    // Parses a decimal number, false on anything else
+    bool to_uint64(uint64_t* value) const;
+
+    const char* data;
+    size_t size;
+};
+
+/* Resumable parser of the status line and headers of an HTTP response.
+ *
+ * parse() is given all the bytes received so far, from the same base
+ * address each time, and only looks at the ones it has not seen yet:
+ * line ends are searched with memchr(), which the C library vectorizes.
+ * Status and headers are views into that buffer, nothing is copied or
+ * allocated, so they are only valid as long as the buffer is. Whatever
+ * follows the empty line ending the headers, from size() on, is left
+ * for the caller.
+ *
+ * Headers beyond MAX_HEADERS are ignored, as are lines without a colon.
+ */
+class ResponseParser {
+public:
+    typedef enum {
+        INCOMPLETE,
+        COMPLETE,
+        INVALID,
+    } Result;
+
+    struct Header {
+        Slice name;
+        Slice value;
+    };
+
+    enum _CONSTANTS {
+        MAX_HEADERS = 32
+    };
+
+    ResponseParser();
+
+    void reset();
+    Result parse(const char* data, size_t size);
+
+    int status() const;
+    int version_major() const;
+    int version_minor() const;
+    Slice status_line() const;
+
+    size_t header_count() const;
+    const Header& header(size_t i) const;
+    // First header named `name` (case insensitive), or NULL
+    const Slice* find(const char* name) const;
+
+    // Length of the status line and headers, the terminating empty line included
+    size_t size() const;
+
+private:
+    bool parse_status_line(Slice line);
+    void parse_header_line(Slice line);
+
+    Result result_;
+    size_t scanned_;     // Bytes already searched for a line end
+    size_t line_start_;  // Offset of the line being received
+    int status_;
+    int version_major_;
+    int version_minor_;
+    Slice status_line_;
+    Header headers_[MAX_HEADERS];
+    size_t header_count_;
+};
+
+/* Skips the body of an HTTP response, framed either by a Content-Length
+ * or by the chunked transfer coding, so that the connection can carry
+ * another request. Fed with whatever arrives after the headers.
+ */
+class BodyDrain {
+public:
+    BodyDrain();
+
+    void reset_length(uint64_t length);
+    // Fails once more than `limit` bytes of chunks, framing included, were consumed
+    void reset_chunked(uint64_t limit);
+
+    // Consumes body bytes, returns how many of `size` belonged to the body
+    size_t consume(const char* data, size_t size);
+
+    bool done() const;
+    bool failed() const;
+
+private:
+    typedef enum {
+        LENGTH,
+        CHUNK_SIZE,
+        CHUNK_EXTENSION,
+        CHUNK_SIZE_LF,
+        CHUNK_DATA,
+        CHUNK_DATA_CR,
+        CHUNK_DATA_LF,
+        TRAILER_START,
+        TRAILER_LINE,
+        FINAL_LF,
+        DONE,
+        FAILED,
+    } State;
+
+    enum _CONSTANTS {
+        MAX_SIZE_DIGITS = 15
+    };
+
+    void end_size_line();
+
+    State state_;
+    uint64_t remaining_;
+    size_t digits_;
+    uint64_t limit_;     // Chunked bodies only
+    uint64_t consumed_;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_HTTP_PARSER_H */
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <puttle-common.h>
+#include <access_record.h>
+
+#include <iostream>  // NOLINT
+#include <fstream>   // NOLINT
+#include <string>
+#include <vector>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+using ::puttle::AccessLogHeader;
+using ::puttle::AccessRecord;
+
+namespace po = ::boost::program_options;
+
+/* Prints the records of an access log written by puttle --access-log.
+ * Returns false if the file is not an access log.
+ */
+static bool dump(const std::string& path, bool csv) {
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    AccessLogHeader header;
+
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || !header.is_valid()) {
+        std::cerr << path << ": not a puttle access log" << std::endl;
+        return false;
+    }
+
+    // A file still being written may hold fewer records than its size allows
+    AccessRecord record;
+    for (uint64_t i = 0; i < header.count; ++i) {
+        if (!file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+            std::cerr << path << ": truncated after " << i << " records" << std::endl;
+            return false;
+        }
+        std::cout << (csv ? record.csv() : record.str()) << '\n';
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
+
+    po::options_description options("puttle-logdump [options] file...");
+    options.add_options()
+    ("csv", "Print the records as CSV")
+    ("help,h", "print this message");
+
+    po::options_description all_opt;
+    all_opt.add(options);
+    all_opt.add_options()
+    ("file", po::value<std::vector<std::string> >(&files), "Access log files");
+
+    po::positional_options_description positional;
+    positional.add("file", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv)
+                  .options(all_opt)
+                  .positional(positional)
+                  .run(),
+                  vm);
+        po::notify(vm);
+    } catch(const po::error& e) {
+        std::cerr << "Error in command line: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (vm.count("help") || files.empty()) {
+        std::cout << options << std::endl;
+        return 1;
+    }
+
+    bool csv = vm.count("csv") > 0;
+    if (csv)
+        std::cout << AccessRecord::CSV_HEADER << '\n';
+
+    int ret = 0;
+    for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it) {
+        if (!dump(*it, csv))
+            ret = 1;
+    }
+    return ret;
+}
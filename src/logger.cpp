@@ -19,9 +19,9 @@
  *
  */
 #include <logger.h>
+#include <async_appender.h>
 
 #include <log4cpp/BasicLayout.hh>
-#include <log4cpp/OstreamAppender.hh>
 #include <log4cpp/NDC.hh>
 
 #include <string>
@@ -51,19 +51,24 @@ void Logger::set_level(const std::string& level) {
     Logger::instance().set_level_impl(level);
 }
 
-Logger::Logger() :
-    syslog(NULL),
-    stdout(NULL) {
-    syslog = new log4cpp::SyslogAppender("syslog", "puttle");
-    syslog->setLayout(new log4cpp::BasicLayout());
+uint64_t Logger::dropped() {
+    return Logger::instance().appender->dropped();
+}
 
-    stdout = new log4cpp::OstreamAppender("puttle", &std::cout);
-    stdout->setLayout(new log4cpp::BasicLayout());
+Logger::Logger() :
+    appender(NULL) {
+    // Syslog and stdout are written by the thread of the appender,
+    // logging never waits on them
+    appender = new AsyncAppender("puttle");
+    appender->setLayout(new log4cpp::BasicLayout());
 
     log4cpp::Category& root = log4cpp::Category::getRoot();
     root.setPriority(log4cpp::Priority::ERROR);
-    root.addAppender(syslog);
-    root.addAppender(stdout);
+    root.addAppender(appender);
+}
+
+Logger::~Logger() {
+    appender->close();
 }
 
 void Logger::set_level_impl(const std::string& level) {
@@ -26,12 +26,13 @@
 
 #include <string>
 #include "log4cpp/Appender.hh"
-#include "log4cpp/SyslogAppender.hh"
 #include "log4cpp/Category.hh"
 
 
 namespace puttle {
 
+class AsyncAppender;
+
 class Logger : public Singleton<Logger> {
     friend class Singleton<Logger>;
 public:
@@ -57,12 +58,17 @@ public:
     static void push_context(const std::string& context);
     static void pop_context();
 
+    // Log messages lost because the writer thread could not keep up
+    static uint64_t dropped();
+
+    // Writes the queued messages out
+    ~Logger();
+
 private:
     Logger();
     void set_level_impl(const std::string& level);
 
-    log4cpp::SyslogAppender* syslog;
-    log4cpp::Appender* stdout;
+    AsyncAppender* appender;
 };
 }
 
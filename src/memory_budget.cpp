@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <memory_budget.h>
+
+namespace puttle {
+
+boost::asio::io_service::id MemoryBudget::id;
+
+MemoryBudget::MemoryBudget(boost::asio::io_service& io_service)  // NOLINT
+    : boost::asio::io_service::service(io_service),
+      used_(0),
+      limit_(0),
+      read_limit_(0) {
+}
+
+void MemoryBudget::shutdown_service() {
+}
+
+void MemoryBudget::set_limit(size_t limit) {
+    limit_ = limit;
+    read_limit_ = limit / 100 * READ_WATERMARK;
+}
+}
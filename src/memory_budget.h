@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_MEMORY_BUDGET_H
+#define PUTTLE_SRC_MEMORY_BUDGET_H
+
+#include <puttle-common.h>
+
+#include <boost/atomic.hpp>
+
+namespace puttle {
+
+/* Memory held by the tunnels of an io_service, against its share of
+ * Settings::memory_budget.
+ *
+ * The relay buffers taken from the BufferPool and a fixed cost per
+ * connection are charged. Above READ_WATERMARK percent of the limit the
+ * relays are throttled, at the limit new connections are no longer
+ * accepted. It is only charged and credited from the thread of the
+ * io_service (see BufferPool), the usage is atomic because the accept
+ * pause of the PuttleServer and the metrics read used() from other threads.
+ */
+class MemoryBudget : public boost::asio::io_service::service {
+public:
+    enum _CONSTANTS {
+        READ_WATERMARK = 80  // Percent of the limit
+    };
+
+    static boost::asio::io_service::id id;
+
+    explicit MemoryBudget(boost::asio::io_service& io_service);  // NOLINT
+
+    static MemoryBudget& get(boost::asio::io_service& io_service) {  // NOLINT
+        return boost::asio::use_service<MemoryBudget>(io_service);
+    }
+
+    // Bytes, 0 is unlimited. Set before the io_service handles tunnels
+    void set_limit(size_t limit);
+    size_t limit() const {
+        return limit_;
+    }
+
+    void charge(size_t bytes) {
+        used_.fetch_add(bytes, boost::memory_order_relaxed);
+    }
+
+    void credit(size_t bytes) {
+        used_.fetch_sub(bytes, boost::memory_order_relaxed);
+    }
+
+    size_t used() const {
+        return used_.load(boost::memory_order_relaxed);
+    }
+
+    // Past the read watermark
+    bool throttled() const {
+        return read_limit_ > 0 && used() >= read_limit_;
+    }
+
+    // Past the limit
+    bool exhausted() const {
+        return limit_ > 0 && used() >= limit_;
+    }
+
+private:
+    void shutdown_service();
+
+    boost::atomic<size_t> used_;
+    size_t limit_;
+    size_t read_limit_;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_MEMORY_BUDGET_H */
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <metrics.h>
+#include <memory_budget.h>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+
+namespace puttle {
+
+boost::asio::io_service::id Metrics::id;
+
+Histogram::Histogram() : sum_(0) {
+    for (size_t i = 0; i < BUCKETS; ++i)
+        counts_[i].store(0, boost::memory_order_relaxed);
+}
+
+void Histogram::record(uint64_t value) {
+    boost::atomic<uint64_t>& count = counts_[bucket(value)];
+    count.store(count.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+    sum_.store(sum_.load(boost::memory_order_relaxed) + value, boost::memory_order_relaxed);
+}
+
+void Histogram::merge_into(std::vector<uint64_t>* counts, uint64_t* sum) const {
+    for (size_t i = 0; i < BUCKETS; ++i)
+        (*counts)[i] += counts_[i].load(boost::memory_order_relaxed);
+    *sum += sum_.load(boost::memory_order_relaxed);
+}
+
+size_t Histogram::bucket(uint64_t value) {
+    if (value < SUB_BUCKETS)
+        return value;
+
+    // The top SUB_BUCKET_BITS + 1 bits of the value select the bucket
+    int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    size_t b = ((shift + 1) << SUB_BUCKET_BITS) + ((value >> shift) & (SUB_BUCKETS - 1));
+    return b < BUCKETS ? b : BUCKETS - 1;
+}
+
+uint64_t Histogram::bucket_max(size_t bucket) {
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+
+    int shift = (bucket >> SUB_BUCKET_BITS) - 1;
+    uint64_t mantissa = SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1));
+    return ((mantissa + 1) << shift) - 1;
+}
+
+uint64_t Histogram::value_at(const std::vector<uint64_t>& counts, double quantile) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < counts.size(); ++i)
+        total += counts[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(quantile * total)), 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen >= rank)
+            return bucket_max(i);
+    }
+    return bucket_max(counts.size() - 1);
+}
+
+Metrics::Metrics(boost::asio::io_service& io_service)  // NOLINT
+    : boost::asio::io_service::service(io_service) {
+}
+
+void Metrics::shutdown_service() {
+}
+
+void Metrics::init(const proxy_vector& proxies) {
+    proxies_.clear();
+    for (proxy_vector::const_iterator it = proxies.begin(); it != proxies.end(); ++it) {
+        proxies_.push_back(new ProxyMetrics());
+        proxies_.back().proxy = it->get();
+    }
+}
+
+Metrics::ProxyMetrics& Metrics::proxy(const Proxy& proxy) {
+    for (size_t i = 0; i < proxies_.size(); ++i) {
+        if (proxies_[i].proxy == &proxy)
+            return proxies_[i];
+    }
+    return unknown_;
+}
+
+namespace {
+
+typedef Counter Metrics::ProxyMetrics::*counter_member;
+typedef Histogram Metrics::ProxyMetrics::*histogram_member;
+
+std::string label(const Proxy& proxy) {
+    std::string name = proxy.host + ":" + boost::lexical_cast<std::string>(proxy.port);
+    std::string escaped = "proxy=\"";
+    for (size_t i = 0; i < name.size(); ++i) {
+        if (name[i] == '"' || name[i] == '\\')
+            escaped += '\\';
+        escaped += name[i];
+    }
+    return escaped + "\"";
+}
+
+void family(std::ostream& out, const char* name, const char* type, const char* help) {  // NOLINT
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+uint64_t sum(const ios_deque& io_services, Counter Metrics::*counter) {
+    uint64_t total = 0;
+    for (ios_deque::const_iterator it = io_services.begin(); it != io_services.end(); ++it)
+        total += (Metrics::get(**it).*counter).value();
+    return total;
+}
+
+uint64_t sum(const ios_deque& io_services, const Proxy& proxy, counter_member counter) {
+    uint64_t total = 0;
+    for (ios_deque::const_iterator it = io_services.begin(); it != io_services.end(); ++it)
+        total += (Metrics::get(**it).proxy(proxy).*counter).value();
+    return total;
+}
+
+void proxy_counter(std::ostream& out, const ios_deque& io_services, const proxy_vector& proxies,  // NOLINT
+                   const char* name, const char* help, counter_member counter) {
+    family(out, name, "counter", help);
+    for (proxy_vector::const_iterator it = proxies.begin(); it != proxies.end(); ++it)
+        out << name << "{" << label(**it) << "} " << sum(io_services, **it, counter) << "\n";
+}
+
+void proxy_summary(std::ostream& out, const ios_deque& io_services, const proxy_vector& proxies,  // NOLINT
+                   const char* name, const char* help, histogram_member histogram) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    family(out, name, "summary", help);
+    for (proxy_vector::const_iterator it = proxies.begin(); it != proxies.end(); ++it) {
+        std::vector<uint64_t> counts(Histogram::BUCKETS);
+        uint64_t total = 0;
+        for (ios_deque::const_iterator ios = io_services.begin(); ios != io_services.end(); ++ios)
+            (Metrics::get(**ios).proxy(**it).*histogram).merge_into(&counts, &total);
+
+        std::string l = label(**it);
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+            out << name << "{" << l << ",quantile=\"" << quantiles[i] << "\"} "
+                << Histogram::value_at(counts, quantiles[i]) / 1e6 << "\n";
+        }
+
+        uint64_t count = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+            count += counts[i];
+        out << name << "_sum{" << l << "} " << total / 1e6 << "\n";
+        out << name << "_count{" << l << "} " << count << "\n";
+    }
+}
+}
+
+std::string Metrics::render(const ios_deque& io_services, const proxy_vector& proxies) {
+    std::ostringstream out;
+
+    family(out, "puttle_accepted_total", "counter", "Connections accepted");
+    out << "puttle_accepted_total " << sum(io_services, &Metrics::accepted) << "\n";
+
+    family(out, "puttle_failures_total", "counter", "Connections dropped before a proxy was used, by phase");
+    out << "puttle_failures_total{phase=\"destination\"} " << sum(io_services, &Metrics::destination_failures) << "\n";
+    out << "puttle_failures_total{phase=\"no-proxy\"} " << sum(io_services, &Metrics::no_proxy) << "\n";
+
+    family(out, "puttle_throttled_total", "counter", "Operations put off by the memory budget");
+    out << "puttle_throttled_total{operation=\"read\"} " << sum(io_services, &Metrics::throttled_reads) << "\n";
+    out << "puttle_throttled_total{operation=\"accept\"} " << sum(io_services, &Metrics::accept_pauses) << "\n";
+
+    uint64_t used = 0, limit = 0;
+    for (ios_deque::const_iterator it = io_services.begin(); it != io_services.end(); ++it) {
+        MemoryBudget& budget = MemoryBudget::get(**it);
+        used += budget.used();
+        limit += budget.limit();
+    }
+    family(out, "puttle_memory_bytes", "gauge", "Relay buffers and connection state in use");
+    out << "puttle_memory_bytes " << used << "\n";
+    family(out, "puttle_memory_budget_bytes", "gauge", "Memory budget of the tunnels, 0 is unlimited");
+    out << "puttle_memory_budget_bytes " << limit << "\n";
+
+    family(out, "puttle_proxy_active_tunnels", "gauge", "Established tunnels currently open");
+    for (proxy_vector::const_iterator it = proxies.begin(); it != proxies.end(); ++it) {
+        // Read closed first, a tunnel closing meanwhile cannot make it negative
+        uint64_t closed = sum(io_services, **it, &ProxyMetrics::closed);
+        uint64_t opened = sum(io_services, **it, &ProxyMetrics::opened);
+        out << "puttle_proxy_active_tunnels{" << label(**it) << "} " << opened - closed << "\n";
+    }
+
+    proxy_counter(out, io_services, proxies, "puttle_proxy_tunnels_total",
+                  "Tunnels established", &ProxyMetrics::opened);
+    proxy_counter(out, io_services, proxies, "puttle_proxy_requests_total",
+                  "CONNECT requests sent", &ProxyMetrics::requests);
+    proxy_counter(out, io_services, proxies, "puttle_proxy_auth_challenges_total",
+                  "CONNECT requests answered with 407", &ProxyMetrics::challenges);
+
+    family(out, "puttle_proxy_failures_total", "counter", "Failures by phase");
+    static const struct {
+        const char* phase;
+        counter_member counter;
+    } phases[] = {
+        { "resolve", &ProxyMetrics::resolve_failures },
+        { "connect", &ProxyMetrics::connect_failures },
+        { "response", &ProxyMetrics::response_failures },
+        { "refused", &ProxyMetrics::refused },
+        { "auth", &ProxyMetrics::auth_failures }
+    };
+    for (proxy_vector::const_iterator it = proxies.begin(); it != proxies.end(); ++it) {
+        std::string l = label(**it);
+        for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); ++i) {
+            out << "puttle_proxy_failures_total{" << l << ",phase=\"" << phases[i].phase << "\"} "
+                << sum(io_services, **it, phases[i].counter) << "\n";
+        }
+    }
+
+    family(out, "puttle_proxy_bytes_total", "counter", "Bytes relayed, up is from the client to the destination");
+    for (proxy_vector::const_iterator it = proxies.begin(); it != proxies.end(); ++it) {
+        std::string l = label(**it);
+        out << "puttle_proxy_bytes_total{" << l << ",direction=\"up\"} "
+            << sum(io_services, **it, &ProxyMetrics::bytes_up) << "\n";
+        out << "puttle_proxy_bytes_total{" << l << ",direction=\"down\"} "
+            << sum(io_services, **it, &ProxyMetrics::bytes_down) << "\n";
+    }
+
+    proxy_summary(out, io_services, proxies, "puttle_proxy_resolve_seconds",
+                  "Time to resolve the proxy address", &ProxyMetrics::resolve);
+    proxy_summary(out, io_services, proxies, "puttle_proxy_connect_seconds",
+                  "Time to connect to the proxy", &ProxyMetrics::connect);
+    proxy_summary(out, io_services, proxies, "puttle_proxy_response_seconds",
+                  "Time from the CONNECT request to the proxy answer", &ProxyMetrics::response);
+
+    return out.str();
+}
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_METRICS_H
+#define PUTTLE_SRC_METRICS_H
+
+#include <puttle-common.h>
+#include <proxy.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+namespace puttle {
+
+/* Monotonic counter with a single writer: the thread of the io_service
+ * owning it. Other threads only read it, so no atomic read-modify-write
+ * is needed.
+ */
+class Counter {
+public:
+    Counter() : value_(0) {
+    }
+
+    void add(uint64_t n = 1) {
+        value_.store(value_.load(boost::memory_order_relaxed) + n, boost::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        return value_.load(boost::memory_order_relaxed);
+    }
+
+private:
+    boost::atomic<uint64_t> value_;
+};
+
+/* Latency histogram in microseconds, with the log-linear buckets of
+ * HdrHistogram: 8 buckets per power of two, so any value is known within
+ * 12.5%, up to 2^34 us (about 4h45). Single writer, like Counter.
+ */
+class Histogram {
+public:
+    enum _CONSTANTS {
+        SUB_BUCKET_BITS = 3,
+        SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+        BUCKETS = 256
+    };
+
+    Histogram();
+
+    void record(uint64_t value);
+
+    // Adds the buckets to `counts` (BUCKETS long) and the values to `sum`
+    void merge_into(std::vector<uint64_t>* counts, uint64_t* sum) const;
+
+    static size_t bucket(uint64_t value);
+    // Highest value falling in `bucket`
+    static uint64_t bucket_max(size_t bucket);
+    // Smallest bucket_max under which a `quantile` of the values fall, 0 if empty
+    static uint64_t value_at(const std::vector<uint64_t>& counts, double quantile);
+
+private:
+    boost::atomic<uint64_t> counts_[BUCKETS];
+    boost::atomic<uint64_t> sum_;
+};
+
+/* What the tunnels of an io_service did, per proxy.
+ *
+ * Every thread updates its own counters without locking, the metrics
+ * endpoint reads and adds those of all the io_services when it is
+ * scraped. init() must be called before the io_service handles tunnels.
+ */
+class Metrics : public boost::asio::io_service::service {
+public:
+    struct ProxyMetrics {
+        ProxyMetrics() : proxy(NULL) {
+        }
+
+        const Proxy* proxy;
+        Counter requests;           // CONNECT requests sent
+        Counter challenges;         // 407 answers
+        Counter opened;             // Established tunnels
+        Counter closed;             // Established tunnels since closed
+        Counter resolve_failures;
+        Counter connect_failures;   // Per connection attempt
+        Counter response_failures;  // No answer, or not HTTP
+        Counter refused;            // Answered with an error status
+        Counter auth_failures;
+        Counter bytes_up;           // Client to destination
+        Counter bytes_down;
+        Histogram resolve;
+        Histogram connect;
+        Histogram response;         // CONNECT request to proxy answer
+    };
+
+    static boost::asio::io_service::id id;
+
+    explicit Metrics(boost::asio::io_service& io_service);  // NOLINT
+
+    static Metrics& get(boost::asio::io_service& io_service) {  // NOLINT
+        return boost::asio::use_service<Metrics>(io_service);
+    }
+
+    void init(const proxy_vector& proxies);
+
+    // Counters of `proxy`, a proxy unknown to init() gets throw-away ones
+    ProxyMetrics& proxy(const Proxy& proxy);
+
+    // Prometheus text exposition of the metrics of all the io_services
+    static std::string render(const ios_deque& io_services, const proxy_vector& proxies);
+
+    Counter accepted;
+    Counter destination_failures;  // SO_ORIGINAL_DST lookup failed
+    Counter no_proxy;              // No proxy could be reached
+    Counter throttled_reads;       // Relay reads put off by the memory budget
+    Counter accept_pauses;         // Accepts put off by the memory budget
+
+private:
+    void shutdown_service();
+
+    boost::ptr_vector<ProxyMetrics> proxies_;
+    ProxyMetrics unknown_;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_METRICS_H */
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <metrics_server.h>
+#include <metrics.h>
+
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include <boost/array.hpp>
+#include <boost/format.hpp>
+
+namespace puttle {
+
+namespace {
+
+/* One scrape: reads the request headers, answers and closes. The
+ * request itself is not looked at.
+ */
+template <typename Protocol>
+class MetricsSession : public boost::enable_shared_from_this<MetricsSession<Protocol> > {
+public:
+    MetricsSession(boost::asio::io_service& io_service, const MetricsServer& server) :  // NOLINT
+        socket_(io_service), server_(server), received_(0) {
+    }
+
+    typename Protocol::socket& socket() {
+        return socket_;
+    }
+
+    void start() {
+        socket_.async_read_some(boost::asio::buffer(request_.data() + received_, request_.size() - received_),
+                                boost::bind(&MetricsSession::handle_read, this->shared_from_this(),
+                                            boost::asio::placeholders::error,
+                                            boost::asio::placeholders::bytes_transferred));
+    }
+
+private:
+    void handle_read(const boost::system::error_code& error, size_t bytes_transferred) {
+        if (error)
+            return;
+
+        received_ += bytes_transferred;
+        if (received_ < request_.size() &&
+                !memmem(request_.data(), received_, "\r\n\r\n", 4) &&
+                !memmem(request_.data(), received_, "\n\n", 2)) {
+            start();
+            return;
+        }
+
+        response_ = server_.response();
+        boost::asio::async_write(socket_, boost::asio::buffer(response_),
+                                 boost::bind(&MetricsSession::handle_write, this->shared_from_this(),
+                                             boost::asio::placeholders::error));
+    }
+
+    void handle_write(const boost::system::error_code& error) {
+        boost::system::error_code ignored;
+        socket_.shutdown(Protocol::socket::shutdown_both, ignored);
+    }
+
+    typename Protocol::socket socket_;
+    const MetricsServer& server_;
+    boost::array<char, 4096> request_;
+    size_t received_;
+    std::string response_;
+};
+}
+
+MetricsServer::MetricsServer(boost::asio::io_service& io_service, const ios_deque& io_services,  // NOLINT
+                             const proxy_vector& proxies, const Settings& settings)
+    : io_service_(io_service),
+      io_services_(io_services),
+      proxies_(proxies),
+      settings_(settings),
+      log(Logger::get_logger("puttle.metrics")) {
+    if (settings_.metrics_port > 0) {
+        tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), settings_.metrics_port);
+        tcp_acceptor_.reset(new tcp::acceptor(io_service_, endpoint, true));
+        start_accept<tcp>(tcp_acceptor_.get());
+        log.info("Serving metrics on http://%s:%d/", endpoint.address().to_string().c_str(),
+                 settings_.metrics_port);
+    }
+
+    if (!settings_.metrics_socket.empty()) {
+        // Left over by a previous run
+        ::unlink(settings_.metrics_socket.c_str());
+        local_acceptor_.reset(new local::acceptor(io_service_, local::endpoint(settings_.metrics_socket)));
+        start_accept<local>(local_acceptor_.get());
+        log.info("Serving metrics on %s", settings_.metrics_socket.c_str());
+    }
+}
+
+MetricsServer::~MetricsServer() {
+    if (local_acceptor_)
+        ::unlink(settings_.metrics_socket.c_str());
+}
+
+std::string MetricsServer::response() const {
+    std::string body = Metrics::render(io_services_, proxies_);
+    body += (boost::format("# HELP puttle_log_dropped_total Log messages dropped because the writer thread lagged\n"
+                           "# TYPE puttle_log_dropped_total counter\n"
+                           "puttle_log_dropped_total %u\n") % Logger::dropped()).str();
+
+    return (boost::format("HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %u\r\n"
+                          "Connection: close\r\n"
+                          "\r\n") % body.size()).str() + body;
+}
+
+template <typename Protocol>
+void MetricsServer::start_accept(typename Protocol::acceptor* acceptor) {
+    boost::shared_ptr<MetricsSession<Protocol> > session(new MetricsSession<Protocol>(io_service_, *this));
+    acceptor->async_accept(session->socket(),
+                           boost::bind(&MetricsServer::handle_accept<Protocol, MetricsSession<Protocol> >,
+                                       this, acceptor, session, boost::asio::placeholders::error));
+}
+
+template <typename Protocol, typename Session>
+void MetricsServer::handle_accept(typename Protocol::acceptor* acceptor, boost::shared_ptr<Session> session,
+                                  const boost::system::error_code& error) {
+    if (error == boost::asio::error::operation_aborted)
+        return;
+
+    if (!error)
+        session->start();
+    else
+        log.warn("Unable to accept a metrics connection: %s", error.message().c_str());
+
+    start_accept<Protocol>(acceptor);
+}
+}
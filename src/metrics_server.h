@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_METRICS_SERVER_H
+#define PUTTLE_SRC_METRICS_SERVER_H
+
+#include <puttle-common.h>
+#include <logger.h>
+#include <proxy.h>
+#include <settings.h>
+
+#include <string>
+
+#include <boost/scoped_ptr.hpp>
+
+namespace puttle {
+
+using boost::asio::ip::tcp;
+
+/* Serves the metrics in the Prometheus text format, on a loopback port
+ * (Settings::metrics_port) and/or a Unix socket (Settings::metrics_socket).
+ *
+ * Any HTTP request gets the metrics of all the io_services, then the
+ * connection is closed. The server runs on the io_service given to the
+ * constructor.
+ */
+class MetricsServer {
+public:
+    MetricsServer(boost::asio::io_service& io_service, const ios_deque& io_services,  // NOLINT
+                  const proxy_vector& proxies, const Settings& settings);
+    ~MetricsServer();
+
+    // Complete HTTP answer
+    std::string response() const;
+
+private:
+    typedef boost::asio::local::stream_protocol local;
+
+    template <typename Protocol>
+    void start_accept(typename Protocol::acceptor* acceptor);
+
+    template <typename Protocol, typename Session>
+    void handle_accept(typename Protocol::acceptor* acceptor, boost::shared_ptr<Session> session,
+                       const boost::system::error_code& error);
+
+    boost::asio::io_service& io_service_;
+    ios_deque io_services_;
+    const proxy_vector& proxies_;
+    const Settings& settings_;
+    boost::scoped_ptr<tcp::acceptor> tcp_acceptor_;
+    boost::scoped_ptr<local::acceptor> local_acceptor_;
+    Logger::Log log;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_METRICS_SERVER_H */
@@ -20,6 +20,9 @@
  */
 
 #include <proxy.h>
+#include <authenticator.h>
+#include <proxy_selection.h>
+#include <circuit_breaker.h>
 
 #include <string>
 
@@ -29,7 +32,10 @@
 namespace puttle {
 Proxy::Proxy() :
     port(3128),
-    host("") {
+    host(""),
+    credentials(new Credentials()),
+    stats(new ProxyStats()),
+    breaker(new CircuitBreaker()) {
 }
 
 Proxy::Proxy(std::string host_, uint16_t port_,
@@ -37,7 +43,10 @@ Proxy::Proxy(std::string host_, uint16_t port_,
     port(port_),
     host(host_),
     username(username_),
-    password(password_) {
+    password(password_),
+    credentials(new Credentials()),
+    stats(new ProxyStats()),
+    breaker(new CircuitBreaker()) {
 }
 
 Proxy Proxy::parse(std::string url) {
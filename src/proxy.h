@@ -30,6 +30,10 @@
 
 namespace puttle {
 
+class Credentials;
+class ProxyStats;
+class CircuitBreaker;
+
 struct Proxy {
 public:
 
@@ -38,6 +42,7 @@ public:
           std::string username_ = "", std::string password_ = "");
 
     static Proxy parse(std::string url);
+    static std::string url_decode(const std::string& uri);
     bool is_valid();
 
     uint16_t port;
@@ -45,9 +50,14 @@ public:
     std::string username;
     std::string password;
 
+    // Authentication state learned from the proxy, shared by all its copies
+    boost::shared_ptr<Credentials> credentials;
+    // Latency, load and failures seen by all the connections through it
+    boost::shared_ptr<ProxyStats> stats;
+    // Whether new tunnels should skip it, shared the same way
+    boost::shared_ptr<CircuitBreaker> breaker;
+
     static const Proxy invalid_proxy;
-private:
-    static std::string url_decode(const std::string& uri);
 };
 
 typedef std::vector<boost::shared_ptr<Proxy> > proxy_vector;
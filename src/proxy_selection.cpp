@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <proxy_selection.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace puttle {
+
+ProxyStats::ProxyStats() :
+    connect_latency_(0),
+    response_latency_(0),
+    failure_score_(0),
+    active_tunnels_(0) {
+}
+
+void ProxyStats::update(boost::atomic<uint64_t>* average, uint64_t sample) {
+    uint64_t old = average->load(boost::memory_order_relaxed);
+    int64_t delta = static_cast<int64_t>(sample) - static_cast<int64_t>(old);
+    average->compare_exchange_strong(old, old + (delta >> EWMA_SHIFT),
+                                     boost::memory_order_relaxed);
+}
+
+void ProxyStats::record_connect(uint64_t micros) {
+    // The first sample is taken as is instead of being averaged with 0
+    uint64_t zero = 0;
+    if (!connect_latency_.compare_exchange_strong(zero, micros, boost::memory_order_relaxed))
+        update(&connect_latency_, micros);
+}
+
+void ProxyStats::record_response(uint64_t micros) {
+    uint64_t zero = 0;
+    if (!response_latency_.compare_exchange_strong(zero, micros, boost::memory_order_relaxed))
+        update(&response_latency_, micros);
+}
+
+void ProxyStats::record_success() {
+    update(&failure_score_, 0);
+}
+
+void ProxyStats::record_failure() {
+    update(&failure_score_, FAILURE_SCALE);
+}
+
+void ProxyStats::tunnel_opened() {
+    active_tunnels_.fetch_add(1, boost::memory_order_relaxed);
+}
+
+void ProxyStats::tunnel_closed() {
+    active_tunnels_.fetch_sub(1, boost::memory_order_relaxed);
+}
+
+uint64_t ProxyStats::connect_latency() const {
+    return connect_latency_.load(boost::memory_order_relaxed);
+}
+
+uint64_t ProxyStats::response_latency() const {
+    return response_latency_.load(boost::memory_order_relaxed);
+}
+
+uint64_t ProxyStats::failure_score() const {
+    return failure_score_.load(boost::memory_order_relaxed);
+}
+
+long ProxyStats::active_tunnels() const {
+    return active_tunnels_.load(boost::memory_order_relaxed);
+}
+
+double ProxyStats::cost() const {
+    double latency = std::max<uint64_t>(connect_latency() + response_latency(), MIN_LATENCY);
+    double failures = 1.0 + 4.0 * failure_score() / FAILURE_SCALE;
+    return latency * (active_tunnels() + 1) * failures;
+}
+
+namespace {
+
+typedef std::pair<double, boost::shared_ptr<Proxy> > costed_proxy;
+
+bool cheaper(const costed_proxy& a, const costed_proxy& b) {
+    return a.first < b.first;
+}
+}
+
+void select_proxies(proxy_vector& proxies, Settings::ProxySelection selection) {  // NOLINT
+    // Ties are broken at random
+    std::random_shuffle(proxies.begin(), proxies.end());
+    if (selection == Settings::SELECT_RANDOM || proxies.size() < 2)
+        return;
+
+    // Costs move under our feet, sort a snapshot of them
+    std::vector<costed_proxy> costed;
+    costed.reserve(proxies.size());
+    for (proxy_vector::const_iterator it = proxies.begin(); it != proxies.end(); ++it)
+        costed.push_back(std::make_pair((*it)->stats->cost(), *it));
+
+    if (selection == Settings::SELECT_P2C) {
+        // After the shuffle the first two are the random choices
+        if (cheaper(costed[1], costed[0]))
+            std::swap(costed[0], costed[1]);
+        std::stable_sort(costed.begin() + 1, costed.end(), cheaper);
+    } else {
+        std::stable_sort(costed.begin(), costed.end(), cheaper);
+    }
+
+    for (size_t i = 0; i < costed.size(); ++i)
+        proxies[i] = costed[i].second;
+}
+}
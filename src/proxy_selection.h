@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_PROXY_SELECTION_H
+#define PUTTLE_SRC_PROXY_SELECTION_H
+
+#include <puttle-common.h>
+#include <proxy.h>
+#include <settings.h>
+
+#include <boost/atomic.hpp>
+
+namespace puttle {
+
+/* Health and load of one proxy, fed by every connection going through it.
+ *
+ * Latencies are exponentially weighted moving averages (alpha = 1/8, as
+ * for the TCP smoothed RTT) in microseconds, the failure score the same
+ * average of the outcomes scaled to FAILURE_SCALE. Updates are lock free,
+ * a lost race only drops one sample.
+ */
+class ProxyStats {
+public:
+    enum _CONSTANTS {
+        EWMA_SHIFT = 3,
+        FAILURE_SCALE = 1024,
+        MIN_LATENCY = 1000  // Floor of the latency used in cost(), in microseconds
+    };
+
+    ProxyStats();
+
+    void record_connect(uint64_t micros);
+    void record_response(uint64_t micros);
+    void record_success();
+    void record_failure();
+
+    void tunnel_opened();
+    void tunnel_closed();
+
+    uint64_t connect_latency() const;
+    uint64_t response_latency() const;
+    uint64_t failure_score() const;
+    long active_tunnels() const;
+
+    /* Expected cost of one more tunnel: the latency times the tunnels
+     * already open, inflated by up to 5x for a failing proxy. Unmeasured
+     * proxies are cheap, so new ones get tried.
+     */
+    double cost() const;
+
+private:
+    static void update(boost::atomic<uint64_t>* average, uint64_t sample);
+
+    boost::atomic<uint64_t> connect_latency_;
+    boost::atomic<uint64_t> response_latency_;
+    boost::atomic<uint64_t> failure_score_;
+    boost::atomic<long> active_tunnels_;
+};
+
+/* Orders `proxies` for a new tunnel, the first one is tried first and the
+ * others are the failover order.
+ *
+ * SELECT_RANDOM shuffles them. SELECT_P2C (power of two choices) puts the
+ * cheaper of two random proxies first. SELECT_LEAST_LOADED puts the
+ * cheapest first. In both cases the failover order is by cost.
+ */
+void select_proxies(proxy_vector& proxies, Settings::ProxySelection selection);  // NOLINT
+}
+
+#endif /* end of include guard: PUTTLE_SRC_PROXY_SELECTION_H */
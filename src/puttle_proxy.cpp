@@ -20,12 +20,19 @@
  */
 #include <puttle_proxy.h>
 #include <logger.h>
+#include <socket_options.h>
+#include <upstream_pool.h>
+#include <connector.h>
+#include <proxy_selection.h>
+#include <circuit_breaker.h>
 #include <linux/netfilter_ipv4.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include <cstring>
+#include <algorithm>
 #include <map>
 #include <string>
-#include <boost/format.hpp>
-#include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/lambda/lambda.hpp>
 #include <boost/lambda/bind.hpp>
@@ -33,21 +40,43 @@
 
 namespace puttle {
 
-typedef boost::asio::detail::socket_option::integer<IPPROTO_IP, IP_TTL> time_to_live;
+const std::string PuttleProxy::no_authorization;
 
-PuttleProxy::PuttleProxy(boost::asio::io_service& io_service, proxy_vector proxies)  // NOLINT
-    : client_socket_(io_service),
+PuttleProxy::PuttleProxy(boost::asio::io_service& io_service, proxy_vector proxies,  // NOLINT
+                         const Settings& settings)
+    : io_service_(io_service),
+      settings_(settings),
+      client_socket_(io_service),
       server_socket_(io_service),
-      resolver_(io_service),
+      pool_(BufferPool::get(io_service)),
+      budget_(MemoryBudget::get(io_service)),
+      charged_(0),
+      early_size_(0),
+      reused_(false),
+      fast_open_(false),
+      received_(0),
+      forwarding_(false),
+      finished_(0),
       proxies_(proxies),
+      metrics_(Metrics::get(io_service)),
+      proxy_metrics_(NULL),
+      access_log_(NULL),
       log(Logger::get_logger("puttle.puttle-proxy")) {
+    memset(&record_, 0, sizeof(record_));
 
-    std::random_shuffle(proxies_.begin(), proxies_.end() );
+    AccessLog& access_log = AccessLog::get(io_service);
+    if (access_log.is_open()) {
+        access_log_ = &access_log;
+        accepted_ = boost::posix_time::microsec_clock::universal_time();
+    }
+
+    channels_[UPSTREAM].buffer_size = settings_.buffer_min;
+    channels_[DOWNSTREAM].buffer_size = settings_.buffer_min;
 }
 
 PuttleProxy::~PuttleProxy() {
-    client_socket_.close();
-    server_socket_.close();
+    shutdown();
+    budget_.credit(charged_);
 }
 
 tcp::socket& PuttleProxy::socket() {
@@ -60,130 +89,269 @@ void PuttleProxy::start_forwarding() {
                      << " -> " << dest_host_ << ":" << dest_port_ << " via: "
                      << (*it_proxy)->host << ":" << (*it_proxy)->port;
 
-    boost::system::error_code ec;
-    handle_server_write(ec);
-    handle_client_write(ec);
-}
+    // Both relays poll the sockets for readiness and then transfer without blocking
+    try {
+        client_socket_.non_blocking(true);
+        server_socket_.non_blocking(true);
+    } catch(const boost::system::system_error &e) {
+        log.errorStream() << "Unable to switch the sockets to non-blocking mode: " << e.what();
+        set_close_reason(AccessRecord::CLOSE_ERROR);
+        shutdown_error();
+        return;
+    }
 
-void PuttleProxy::init_forward() {
-    it_proxy = proxies_.begin();
-    resolve_destination();
+    (*it_proxy)->stats->tunnel_opened();
+    proxy_metrics_->opened.add();
+    forwarding_ = true;
+    if (access_log_ != NULL)
+        established_ = boost::posix_time::microsec_clock::universal_time();
+
+    // Those already went out behind the CONNECT request
+    if (early_size_ > 0) {
+        count_bytes(UPSTREAM, early_size_);
+        pool_.release(early_buffer_);
+        early_size_ = 0;
+    }
+
+    // The destination may have spoken right after the proxy answer
+    size_t early = received_ - response_.size();
+    if (early > 0) {
+        count_bytes(DOWNSTREAM, early);
+        boost::asio::async_write(client_socket_,
+                                 boost::asio::buffer(response_buffer_.data + response_.size(), early),
+                                 boost::bind(&PuttleProxy::handle_early_write, shared_from_this(),
+                                             boost::asio::placeholders::error));
+        return;
+    }
+
+    pool_.release(response_buffer_);
+    start_relays();
 }
 
-void PuttleProxy::resolve_destination() {
-    if (it_proxy != proxies_.end()) {
-        Proxy& p = *(it_proxy->get());
+void PuttleProxy::handle_early_write(const boost::system::error_code& error) {
+    pool_.release(response_buffer_);
 
-        log.debug("Resolving %s:%u", p.host.c_str(), p.port);
-        tcp::resolver::query query(p.host, boost::lexical_cast<std::string>(p.port));
-        resolver_.async_resolve(query,
-                                boost::bind(&PuttleProxy::handle_resolve, shared_from_this(),
-                                            boost::asio::placeholders::error,
-                                            boost::asio::placeholders::iterator));
-    } else {
+    if (error) {
+        set_close_reason(AccessRecord::CLOSE_ERROR);
         shutdown();
+        return;
     }
+
+    start_relays();
 }
 
-void PuttleProxy::handle_resolve(const boost::system::error_code& error,
-                                 tcp::resolver::iterator endpoint_iterator) {
-    if (!error) {
-        // Attempt a connection to the first endpoint in the list. Each endpoint
-        // will be tried until we successfully establish a connection.
-        tcp::endpoint endpoint = *endpoint_iterator;
+void PuttleProxy::start_relays() {
+    if (settings_.relay_mode == Settings::RELAY_SPLICE && open_pipes()) {
+        splice_transfer(UPSTREAM);
+        splice_transfer(DOWNSTREAM);
+        return;
+    }
 
-        try {
-            // If the socket was previously opened, close it.
-            if (server_socket_.is_open())
-                server_socket_.close();
+    relay_read(UPSTREAM);
+    relay_read(DOWNSTREAM);
+}
 
-            // Opens the socket so we can set the ttl option
-            server_socket_.open(boost::asio::ip::tcp::v4());
+void PuttleProxy::init_forward() {
+    metrics_.accepted.add();
+
+    // From the thread of the io_service, the only one charging its budget
+    charged_ = sizeof(*this) + proxies_.capacity() * sizeof(proxy_vector::value_type);
+    budget_.charge(charged_);
+
+    boost::system::error_code profile_error = apply_socket_profile(client_socket_, settings_.client_socket);
+    if (profile_error)
+        log.debug("Unable to apply the client socket profile: %s", profile_error.message().c_str());
+    select_proxies(proxies_, settings_.proxy_selection);
+
+    // Skip the proxies known to be down, they will be probed by other tunnels
+    proxy_vector allowed;
+    for (proxy_iterator it = proxies_.begin(); it != proxies_.end(); ++it) {
+        if ((*it)->breaker->available())
+            allowed.push_back(*it);
+        else
+            log.debug("Skipping %s:%u, its circuit breaker is open", (*it)->host.c_str(), (*it)->port);
+    }
+    proxies_.swap(allowed);
+    if (proxies_.empty())
+        log.error("The circuit breakers of all the proxies are open, dropping the connection");
+
+    if (access_log_ != NULL) {
+        boost::system::error_code error;
+        tcp::endpoint client = client_socket_.remote_endpoint(error);
+        AccessRecord::set_address(record_.client, client.address());
+        record_.client_port = client.port();
+    }
 
-            time_to_live ttl(42);
-            server_socket_.set_option(ttl);
+    it_proxy = proxies_.begin();
+    if (!lookup_destination()) {
+        set_close_reason(AccessRecord::CLOSE_NO_DESTINATION);
+        metrics_.destination_failures.add();
+        shutdown();
+        return;
+    }
 
-            boost::asio::socket_base::keep_alive keep_alive(true);
-            server_socket_.set_option(keep_alive);
+    connect_proxy();
+}
 
-            server_socket_.async_connect(endpoint,
-                                         boost::bind(&PuttleProxy::handle_connect, shared_from_this(),
-                                                 boost::asio::placeholders::error, ++endpoint_iterator));
-        } catch(const boost::system::system_error &e) {
-            log.errorStream() << "Could not open a socket: " << e.what();
-            shutdown_error();
+void PuttleProxy::connect_proxy() {
+    reused_ = false;
+    fast_open_ = false;
+
+    // A proxy with an open breaker is probed by the Connector on a fresh
+    // connection, which claims the probe only when it is actually tried
+    if (it_proxy != proxies_.end() && settings_.upstream_pool_size > 0 &&
+            (*it_proxy)->breaker->state() == CircuitBreaker::CLOSED) {
+        UpstreamPool::socket_ptr socket = UpstreamPool::get(io_service_).take(**it_proxy);
+        if (socket) {
+            log.debug("Using a pooled connection to %s:%u", (*it_proxy)->host.c_str(), (*it_proxy)->port);
+            server_socket_ = std::move(*socket);
+            reused_ = true;
+            setup_proxy();
+            return;
         }
-    } else {
-        log.error("Unable to resolve: %s:%u, skipping", (*it_proxy)->host.c_str(), (*it_proxy)->port);
-        it_proxy++;
-        resolve_destination();
     }
+
+    connect_upstream();
 }
 
-void PuttleProxy::handle_connect(const boost::system::error_code& error,
-                                 tcp::resolver::iterator endpoint_iterator) {
-    if (!error) {
-        setup_proxy();
-    } else if (endpoint_iterator != tcp::resolver::iterator()) {
-        // The connection failed. Try the next endpoint in the list.
-        server_socket_.close();
-        tcp::endpoint endpoint = *endpoint_iterator;
-        server_socket_.async_connect(endpoint,
-                                     boost::bind(&PuttleProxy::handle_connect, shared_from_this(),
-                                             boost::asio::placeholders::error, ++endpoint_iterator));
-    } else {
-        log.error("Unable to connect to %s:%u, skippin", (*it_proxy)->host.c_str(), (*it_proxy)->port);
-        it_proxy++;
-        resolve_destination();
+void PuttleProxy::connect_upstream() {
+    if (it_proxy == proxies_.end()) {
+        set_close_reason(AccessRecord::CLOSE_NO_PROXY);
+        metrics_.no_proxy.add();
+        shutdown();
+        return;
     }
+
+    // Race the current proxy and the ones after it
+    proxy_vector candidates(it_proxy, proxies_.end());
+    Connector::create(io_service_, candidates, settings_)->start(
+        boost::bind(&PuttleProxy::handle_upstream_connect, shared_from_this(), _1, _2, _3, _4));
 }
 
-void PuttleProxy::setup_proxy() {
+void PuttleProxy::handle_upstream_connect(const boost::system::error_code& error, size_t candidate,
+                                          Connector::socket_ptr socket, bool fast_open) {
+    if (error) {
+        log.error("Unable to connect to any proxy: %s", error.message().c_str());
+        set_close_reason(AccessRecord::CLOSE_NO_PROXY);
+        metrics_.no_proxy.add();
+        shutdown();
+        return;
+    }
+
+    if (candidate > 0) {
+        // Credentials are per proxy
+        authenticator_.reset();
+        it_proxy += candidate;
+    }
+
+    server_socket_ = std::move(*socket);
+    fast_open_ = fast_open;
+    setup_proxy();
+}
+
+bool PuttleProxy::lookup_destination() {
     struct sockaddr_in client;
     socklen_t len = sizeof(client);
-    uint32_t _ip;
-    uint16_t _port;
 
-    getsockopt(client_socket_.native(), SOL_IP, SO_ORIGINAL_DST, (struct sockaddr*) &client, &len);
-    _ip = ntohl(client.sin_addr.s_addr);
-    _port = ntohs(client.sin_port);
+    if (settings_.destination_port != 0) {
+        client.sin_addr.s_addr = htonl(settings_.destination_address);
+        client.sin_port = htons(settings_.destination_port);
+    } else {
+        int ret = getsockopt(client_socket_.native_handle(), SOL_IP, SO_ORIGINAL_DST,
+                             (struct sockaddr*) &client, &len);
+        if (ret != 0) {
+            log.error("Unable to get the original destination: %s", strerror(errno));
+            return false;
+        }
+    }
+
+    request_.set_destination(ntohl(client.sin_addr.s_addr), ntohs(client.sin_port));
+    AccessRecord::set_address(record_.destination, boost::asio::ip::address_v4(ntohl(client.sin_addr.s_addr)));
+    record_.destination_port = ntohs(client.sin_port);
 
-    dest_host_ = (boost::format("%s") %boost::asio::ip::address_v4(_ip)).str();
-    dest_port_ = boost::lexical_cast<std::string>(_port);
+    // Short enough for the strings to keep them inline
+    Slice host = request_.host();
+    Slice port = request_.port();
+    dest_host_.assign(host.data, host.size);
+    dest_port_.assign(port.data, port.size);
+    return true;
+}
+
+void PuttleProxy::setup_proxy() {
+    proxy_metrics_ = &metrics_.proxy(**it_proxy);
 
-    boost::format fmt = boost::format("CONNECT %1%:%2% HTTP/1.1\r\n" \
-                                      "User-Agent: Mozilla/5.0 (X11; U; AmigaOS x86_64; eo-EO; rv:42.6.6)r\n" \
-                                      "Proxy-Connection: keep-alive\r\n" \
-                                      "Host: %1%:%2%\r\n") % dest_host_ % dest_port_;
-    std::string connect_string = fmt.str();
+    if (authenticator_ == NULL) {
+        // Answer the last challenge of this proxy without waiting for a 407
+        authenticator_ = (*it_proxy)->credentials->authenticator(**it_proxy, dest_host_, dest_port_);
+    }
 
+    const std::string* authorization = &no_authorization;
     if (authenticator_ != NULL) {
         if (authenticator_->has_error()) {
             log.error("Unable to authenticate the request to: %s:%s", dest_host_.c_str(), dest_port_.c_str());
             log_headers(Logger::ERROR, "Headers", authenticator_->get_headers());
             log.errorStream() << "Answer:";
             log.errorStream() << authenticator_->get_token();
+            set_close_reason(AccessRecord::CLOSE_AUTH);
+            proxy_metrics_->auth_failures.add();
             shutdown();
+            return;
         } else if (authenticator_->has_token()) {
-            std::string token = authenticator_->get_token();
-            connect_string += token;
-            log.debugStream() << "Autenticator: " << token;
+            authorization = &authenticator_->get_token();
+            log.debugStream() << "Autenticator: " << *authorization;
         }
     }
 
-    connect_string += "\r\n";
+    if (settings_.early_data && early_size_ == 0)
+        read_early_data();
+
+    // The early client bytes follow the request in the same write
+    ConnectRequest::buffers_type request = request_.buffers(*authorization);
+    request_buffers buffers;
+    std::copy(request.begin(), request.end(), buffers.begin());
+    buffers.back() = boost::asio::buffer(early_buffer_.data, early_size_);
 
-    boost::asio::async_write(server_socket_,
-                             boost::asio::buffer(connect_string),
+    request_sent_ = boost::posix_time::microsec_clock::universal_time();
+    proxy_metrics_->requests.add();
+    boost::asio::async_write(server_socket_, buffers,
                              boost::bind(&PuttleProxy::handle_proxy_connect, shared_from_this(),
                                          boost::asio::placeholders::error));
 }
 
+/* Takes what the client already sent without waiting for it: protocols
+ * where the server speaks first just send nothing early.
+ */
+void PuttleProxy::read_early_data() {
+    boost::system::error_code error;
+    client_socket_.non_blocking(true, error);
+    if (error)
+        return;
+
+    BufferPool::Buffer buffer = pool_.acquire(EARLY_SIZE);
+    size_t bytes_transferred = client_socket_.read_some(boost::asio::buffer(buffer.data, buffer.size), error);
+    if (error) {
+        // Nothing yet, or an error the relay will run into again
+        pool_.release(buffer);
+        return;
+    }
+
+    log.debug("Sending %u client bytes along with the CONNECT request", static_cast<unsigned>(bytes_transferred));
+    early_buffer_ = buffer;
+    early_size_ = bytes_transferred;
+}
+
 void PuttleProxy::handle_proxy_connect(const boost::system::error_code& error) {
-    boost::asio::async_read(
-        server_socket_,
-        boost::asio::buffer(server_data_, BUFFER_SIZE),
-        boost::asio::transfer_at_least(1),
+    if (response_buffer_.data == NULL)
+        response_buffer_ = pool_.acquire(BUFFER_SIZE);
+    received_ = 0;
+    response_.reset();
+
+    read_proxy_response();
+}
+
+void PuttleProxy::read_proxy_response() {
+    server_socket_.async_read_some(
+        boost::asio::buffer(response_buffer_.data + received_, response_buffer_.size - received_),
         boost::bind(&PuttleProxy::handle_proxy_response, shared_from_this(),
                     boost::asio::placeholders::error,
                     boost::asio::placeholders::bytes_transferred));
@@ -192,69 +360,99 @@ void PuttleProxy::handle_proxy_connect(const boost::system::error_code& error) {
 void PuttleProxy::handle_proxy_response(const boost::system::error_code& error,
                                         size_t bytes_transferred) {
     if (!error) {
-        if (server_headers_.empty())
-            server_headers_ = std::string(server_data_.data(), bytes_transferred);
-        else
-            server_headers_ += std::string(server_data_.data(), bytes_transferred);
-
-        if (server_headers_.find("\r\n\r\n") == std::string::npos &&
-                server_headers_.find("\n\n") == std::string::npos) {
-            // Need more headers
-            boost::asio::async_read(
-                server_socket_,
-                boost::asio::buffer(server_data_, BUFFER_SIZE),
-                boost::asio::transfer_at_least(1),
-                boost::bind(&PuttleProxy::handle_proxy_response, shared_from_this(),
-                            boost::asio::placeholders::error,
-                            boost::asio::placeholders::bytes_transferred));
-        } else {
+        received_ += bytes_transferred;
+
+        switch (response_.parse(response_buffer_.data, received_)) {
+        case ResponseParser::COMPLETE:
             check_proxy_response();
+            break;
+        case ResponseParser::INCOMPLETE:
+            if (received_ < response_buffer_.size) {
+                // Need more headers
+                read_proxy_response();
+                break;
+            }
+            log.error("The proxy answer is larger than %u bytes", static_cast<unsigned>(response_buffer_.size));
+            (*it_proxy)->breaker->record_failure();
+            set_close_reason(AccessRecord::CLOSE_PROXY_ERROR);
+            proxy_metrics_->response_failures.add();
+            shutdown_error();
+            break;
+        case ResponseParser::INVALID:
+            log.error("Unable to parse the proxy answer, first line contains garbage");
+            log.debug(response_.status_line().str());
+            (*it_proxy)->stats->record_failure();
+            (*it_proxy)->breaker->record_failure();
+            set_close_reason(AccessRecord::CLOSE_PROXY_ERROR);
+            proxy_metrics_->response_failures.add();
+            shutdown_error();
+            break;
         }
+    } else if (reused_ && received_ == 0) {
+        // The proxy dropped the idle connection before we used it
+        log.debug("Connection to %s:%u is stale, reconnecting",
+                  (*it_proxy)->host.c_str(), (*it_proxy)->port);
+        reused_ = false;
+        pool_.release(response_buffer_);
+        connect_upstream();
+    } else if (fast_open_ && !reused_ && received_ == 0) {
+        // The fast open handshake happened along with the request: this is
+        // a connect failure, move on to the next proxy
+        log.debug("Unable to connect to %s:%u: %s", (*it_proxy)->host.c_str(), (*it_proxy)->port,
+                  error.message().c_str());
+        (*it_proxy)->stats->record_failure();
+        (*it_proxy)->breaker->record_failure();
+        proxy_metrics_->connect_failures.add();
+        pool_.release(response_buffer_);
+        server_socket_.close();
+        authenticator_.reset();
+        ++it_proxy;
+        connect_upstream();
     } else {
         log.error("Error while reading proxy response: %s", error.message().c_str());
+        (*it_proxy)->stats->record_failure();
+        (*it_proxy)->breaker->record_failure();
+        set_close_reason(AccessRecord::CLOSE_PROXY_ERROR);
+        proxy_metrics_->response_failures.add();
         shutdown();
     }
 }
 
 void PuttleProxy::check_proxy_response() {
-    size_t pos = server_headers_.find("HTTP/");
-
-    // HTTP/ Should be the first header line
-    if ( pos != 0 ) {
-        log.error("Unable to parse the proxy answer, first line contains garbage");
-        log.debug(server_headers_);
-        shutdown_error();
-    }
+    int http_status = response_.status();
 
-    size_t first_space = server_headers_.find_first_of(" ", pos);
-    std::string status = server_headers_.substr(first_space + 1, 3);
+    log.debugStream() << "Got a \"" << http_status << "\" status code";
+    record_.status = http_status;
 
-    std::string headers(server_headers_);
-    std::string::size_type index;
-    std::string line;
-    while ((index = headers.find("\r\n")) != std::string::npos) {
-        line = headers.substr(0, index);
-        headers.erase(0, index+2);
-        if (line == "")
-            break;
-        index = line.find(": ");
-        if (index == std::string::npos) {
-            continue;  // Probably the status line
-        }
-        headers_.insert(std::make_pair(line.substr(0, index), line.substr(index+2)));
+    // Only now for fast open connections, they have no peer before the handshake
+    if (access_log_ != NULL) {
+        boost::system::error_code error;
+        tcp::endpoint proxy = server_socket_.remote_endpoint(error);
+        AccessRecord::set_address(record_.proxy, proxy.address());
+        record_.proxy_port = proxy.port();
     }
 
-    int http_status = 0;
-    try {
-        http_status = boost::lexical_cast<int>(status);
-    } catch(const boost::bad_lexical_cast& e) {
-        // We failed to parse the proxy answer
-        log.error("Unable to parse the proxy answer");
-        shutdown_error();
+    ProxyStats& stats = *(*it_proxy)->stats;
+    uint64_t micros = (boost::posix_time::microsec_clock::universal_time() - request_sent_)
+                      .total_microseconds();
+    stats.record_response(micros);
+    proxy_metrics_->response.record(micros);
+    if (http_status == 407)
+        proxy_metrics_->challenges.add();
+    else if (http_status != 200)
+        proxy_metrics_->refused.add();
+
+    // A refusal of the destination (403, 502, 504...) still shows a working
+    // proxy, only its own errors count against it
+    if (proxy_failed(http_status)) {
+        stats.record_failure();
+        (*it_proxy)->breaker->record_failure();
+    } else {
+        if (http_status == 200)
+            stats.record_success();
+        (*it_proxy)->breaker->record_success();
     }
 
-    log.debugStream() << "Got a \"" << status << "\" status code";
-
     switch (http_status) {
     case 200:
         start_forwarding();
@@ -264,39 +462,148 @@ void PuttleProxy::check_proxy_response() {
         break;
     default:
         log.error("Unknown http status code: %d", http_status);
-        log_headers(Logger::ERROR, "Proxy error", headers_);
+        if (log.isPriorityEnabled(Logger::ERROR)) {
+            copy_headers();
+            log_headers(Logger::ERROR, "Proxy error", headers_);
+        }
+        set_close_reason(AccessRecord::CLOSE_PROXY_REFUSED);
         shutdown();
         break;
     }
 }
 
+// Server errors but the gateway ones, which are about the destination
+bool PuttleProxy::proxy_failed(int http_status) {
+    return http_status >= 500 && http_status != 502 && http_status != 504;
+}
+
+void PuttleProxy::copy_headers() {
+    headers_.clear();
+    for (size_t i = 0; i < response_.header_count(); ++i) {
+        const ResponseParser::Header& h = response_.header(i);
+        headers_.insert(std::make_pair(h.name.str(), h.value.str()));
+    }
+}
+
 void PuttleProxy::handle_proxy_auth() {
+    // Authenticators work on their own copy of the headers, 407 are rare enough
+    copy_headers();
+
     if (headers_.find("Proxy-Authenticate") != headers_.end()) {
-        if ( authenticator_ == NULL ) {
-            std::string method = headers_["Proxy-Authenticate"];
-            method = method.substr(0, method.find_first_of(" "));
+        Proxy& proxy = **it_proxy;
+        std::string method = headers_["Proxy-Authenticate"];
+        method = method.substr(0, method.find_first_of(" "));
+        Authenticator::Method m = Authenticator::get_method(method);
 
-            Authenticator::Method m = Authenticator::get_method(method);
-            authenticator_ = Authenticator::create(m, *(it_proxy->get()), dest_host_, dest_port_);
-        }
+        // Let the next connections through this proxy authenticate up front
+        proxy.credentials->learn(proxy, m, headers_);
 
-        if (authenticator_ != NULL) {
-            authenticator_->set_headers(headers_);
+        if (authenticator_ == NULL || authenticator_->method() != m)
+            authenticator_ = Authenticator::create(m, proxy, dest_host_, dest_port_);
+
+        if (authenticator_ == NULL) {
+            log.error("Unsupported authentication method: %s", method.c_str());
+            set_close_reason(AccessRecord::CLOSE_AUTH);
+            proxy_metrics_->auth_failures.add();
+            shutdown_error();
+            return;
         }
 
-        log_headers(Logger::DEBUG, "Authentication", headers_);
+        authenticator_->set_headers(headers_);
 
-        server_headers_.clear();
-        headers_.clear();
-        server_socket_.close();
+        log_headers(Logger::DEBUG, "Authentication", headers_);
 
-        resolve_destination();
+        // A proxy keeping the connection would take the early bytes for the next request
+        if (early_size_ > 0 || !reuse_proxy_connection())
+            reconnect_proxy();
     } else {
         /* FIXME: Can we get here ? */
+        set_close_reason(AccessRecord::CLOSE_AUTH);
+        proxy_metrics_->auth_failures.add();
         shutdown_error();
     }
 }
 
+bool PuttleProxy::proxy_keeps_alive() const {
+    // Persistent by default from HTTP/1.1 on
+    bool keep_alive = response_.version_major() > 1 ||
+                      (response_.version_major() == 1 && response_.version_minor() > 0);
+
+    const char* names[] = { "Connection", "Proxy-Connection" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        const Slice* value = response_.find(names[i]);
+        if (value == NULL)
+            continue;
+        if (value->icontains("close"))
+            return false;
+        if (value->icontains("keep-alive"))
+            keep_alive = true;
+    }
+    return keep_alive;
+}
+
+bool PuttleProxy::reuse_proxy_connection() {
+    if (!proxy_keeps_alive())
+        return false;
+
+    // Without framing the body runs until the proxy closes the connection
+    const Slice* encoding = response_.find("Transfer-Encoding");
+    const Slice* length = response_.find("Content-Length");
+    uint64_t n;
+    if (encoding != NULL && encoding->icontains("chunked")) {
+        drain_.reset_chunked(MAX_DRAIN_SIZE);
+    } else if (length != NULL && length->to_uint64(&n) && n <= MAX_DRAIN_SIZE) {
+        drain_.reset_length(n);
+    } else {
+        return false;
+    }
+
+    // Part of the body may have come along with the headers
+    headers_.clear();
+    drain_proxy_body(response_buffer_.data + response_.size(), received_ - response_.size());
+    return true;
+}
+
+void PuttleProxy::drain_proxy_body(const char* data, size_t size) {
+    drain_.consume(data, size);
+
+    if (drain_.failed()) {
+        log.debug("Unable to skip the body of the proxy answer, reconnecting");
+        reconnect_proxy();
+    } else if (drain_.done()) {
+        log.debug("Retrying on the same connection to %s:%u", (*it_proxy)->host.c_str(), (*it_proxy)->port);
+        reused_ = true;
+        setup_proxy();
+    } else {
+        if (response_buffer_.data == NULL)
+            response_buffer_ = pool_.acquire(BUFFER_SIZE);
+
+        server_socket_.async_read_some(
+            boost::asio::buffer(response_buffer_.data, response_buffer_.size),
+            boost::bind(&PuttleProxy::handle_proxy_drain, shared_from_this(),
+                        boost::asio::placeholders::error,
+                        boost::asio::placeholders::bytes_transferred));
+    }
+}
+
+void PuttleProxy::handle_proxy_drain(const boost::system::error_code& error,
+                                     size_t bytes_transferred) {
+    if (!error) {
+        drain_proxy_body(response_buffer_.data, bytes_transferred);
+    } else {
+        log.debug("Proxy closed the connection after the 407: %s", error.message().c_str());
+        reconnect_proxy();
+    }
+}
+
+void PuttleProxy::reconnect_proxy() {
+    pool_.release(response_buffer_);
+    headers_.clear();
+    server_socket_.close();
+
+    connect_proxy();
+}
+
 void PuttleProxy::log_headers(const Logger::Priority& priority, std::string context, const headers_map& headers) {
     if (!log.isPriorityEnabled(priority))
             return;
@@ -309,67 +616,310 @@ void PuttleProxy::log_headers(const Logger::Priority& priority, std::string cont
     Logger::pop_context();
 }
 
-void PuttleProxy::handle_server_read(const boost::system::error_code& error,
-                                     size_t bytes_transferred) {
-    if (!error) {
-        boost::asio::async_write(client_socket_,
-                                 boost::asio::buffer(server_data_, bytes_transferred),
-                                 boost::bind(&PuttleProxy::handle_server_write, shared_from_this(),
-                                             boost::asio::placeholders::error));
+void PuttleProxy::relay_read(Direction direction) {
+    Channel& channel = channels_[direction];
+
+    // Keep at most relay_window chunks per direction. A buffer is only
+    // taken from the pool when there is something to read, idle channels
+    // wait for readiness without holding any.
+    while (!channel.waiting && !channel.eof && channel.ready.size() < settings_.relay_window) {
+        // Past the read watermark a channel keeps a single smallest chunk in
+        // flight: memory stops growing and every tunnel still moves on. The
+        // write completion reads again.
+        bool throttled = budget_.throttled();
+        if (throttled && !channel.ready.empty()) {
+            metrics_.throttled_reads.add();
+            return;
+        }
 
+        BufferPool::Buffer buffer = pool_.acquire(throttled ? settings_.buffer_min : channel.buffer_size);
+        boost::system::error_code error;
+        size_t bytes_transferred = source(direction).read_some(
+                                       boost::asio::buffer(buffer.data, buffer.size), error);
+
+        if (error == boost::asio::error::would_block) {
+            pool_.release(buffer);
+            channel.waiting = true;
+            source(direction).async_read_some(boost::asio::null_buffers(),
+                                              boost::bind(&PuttleProxy::handle_relay_ready, shared_from_this(),
+                                                      direction, boost::asio::placeholders::error));
+            return;
+        } else if (error == boost::asio::error::eof) {
+            // Pass the EOF on once what was read before is written
+            pool_.release(buffer);
+            channel.eof = true;
+            if (channel.ready.empty())
+                finish_direction(direction);
+            return;
+        } else if (error) {
+            pool_.release(buffer);
+            closed_by(direction, error);
+            shutdown();
+            return;
+        }
+
+        count_bytes(direction, bytes_transferred);
+        adapt_buffer_size(direction, bytes_transferred, buffer.size);
+        channel.ready.push_back(Chunk(buffer, bytes_transferred));
+        relay_write(direction);
+    }
+}
+
+void PuttleProxy::adapt_buffer_size(Direction direction, size_t bytes_transferred, size_t capacity) {
+    Channel& channel = channels_[direction];
+
+    if (bytes_transferred == capacity) {
+        // Bulk transfer: fewer, larger reads
+        channel.small_reads = 0;
+        channel.buffer_size = std::min(capacity * 2, settings_.buffer_max);
+    } else if (bytes_transferred < capacity / 4) {
+        // Interactive flow: give the memory back
+        if (++channel.small_reads >= SHRINK_AFTER) {
+            channel.small_reads = 0;
+            channel.buffer_size = std::max(capacity / 2, settings_.buffer_min);
+        }
     } else {
-        shutdown();
+        channel.small_reads = 0;
     }
 }
 
-void PuttleProxy::handle_client_read(const boost::system::error_code& error,
-                                     size_t bytes_transferred) {
-    if (!error) {
-        boost::asio::async_write(server_socket_,
-                                 boost::asio::buffer(client_data_, bytes_transferred),
-                                 boost::bind(&PuttleProxy::handle_client_write, shared_from_this(),
-                                             boost::asio::placeholders::error));
+void PuttleProxy::handle_relay_ready(Direction direction, const boost::system::error_code& error) {
+    channels_[direction].waiting = false;
 
+    if (!error) {
+        relay_read(direction);
     } else {
+        set_close_reason(AccessRecord::CLOSE_ERROR);
         shutdown();
     }
 }
 
-void PuttleProxy::handle_client_write(const boost::system::error_code& error) {
+void PuttleProxy::relay_write(Direction direction) {
+    Channel& channel = channels_[direction];
+
+    if (channel.writing || channel.ready.empty())
+        return;
+
+    // Everything read so far leaves in a single gather write
+    channel.gather.clear();
+    for (std::deque<Chunk>::const_iterator it = channel.ready.begin();
+            it != channel.ready.end(); ++it) {
+        channel.gather.push_back(boost::asio::buffer(it->buffer.data, it->length));
+    }
+    channel.writing = channel.ready.size();
+
+    boost::asio::async_write(sink(direction), channel.gather,
+                             boost::bind(&PuttleProxy::handle_relay_write, shared_from_this(), direction,
+                                         boost::asio::placeholders::error));
+}
+
+void PuttleProxy::handle_relay_write(Direction direction, const boost::system::error_code& error) {
+    Channel& channel = channels_[direction];
+
     if (!error) {
-        boost::asio::async_read(
-            client_socket_,
-            boost::asio::buffer(client_data_, BUFFER_SIZE),
-            boost::asio::transfer_at_least(1),
-            boost::bind(&PuttleProxy::handle_client_read, shared_from_this(),
-                        boost::asio::placeholders::error,
-                        boost::asio::placeholders::bytes_transferred));
+        for (; channel.writing > 0; --channel.writing) {
+            pool_.release(channel.ready.front().buffer);
+            channel.ready.pop_front();
+        }
+        relay_write(direction);
+        if (!channel.eof)
+            relay_read(direction);
+        else if (channel.ready.empty())
+            finish_direction(direction);
     } else {
+        set_close_reason(AccessRecord::CLOSE_ERROR);
         shutdown();
     }
 }
 
-void PuttleProxy::handle_server_write(const boost::system::error_code& error) {
-    if (!error) {
-        boost::asio::async_read(
-            server_socket_,
-            boost::asio::buffer(server_data_, BUFFER_SIZE),
-            boost::asio::transfer_at_least(1),
-            boost::bind(&PuttleProxy::handle_server_read, shared_from_this(),
-                        boost::asio::placeholders::error,
-                        boost::asio::placeholders::bytes_transferred));
+/* The source of `direction` reached EOF and everything it sent was
+ * written: the sink gets the EOF too, while the other direction keeps
+ * going until it is done as well.
+ */
+void PuttleProxy::finish_direction(Direction direction) {
+    closed_by(direction, boost::asio::error::eof);
+
+    boost::system::error_code error;
+    sink(direction).shutdown(tcp::socket::shutdown_send, error);
+    if (error || ++finished_ == 2)
+        shutdown();
+}
+
+tcp::socket& PuttleProxy::source(Direction direction) {
+    return direction == UPSTREAM ? client_socket_ : server_socket_;
+}
+
+tcp::socket& PuttleProxy::sink(Direction direction) {
+    return direction == UPSTREAM ? server_socket_ : client_socket_;
+}
+
+bool PuttleProxy::open_pipes() {
+    for (int i = UPSTREAM; i <= DOWNSTREAM; ++i) {
+        if (pipe2(pipes_[i].fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+            log.warn("Unable to create a splice pipe (%s), falling back to copy", strerror(errno));
+            close_pipes();
+            return false;
+        }
+    }
+    return true;
+}
+
+void PuttleProxy::close_pipes() {
+    for (int i = UPSTREAM; i <= DOWNSTREAM; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            if (pipes_[i].fds[j] >= 0)
+                ::close(pipes_[i].fds[j]);
+            pipes_[i].fds[j] = -1;
+        }
+        pipes_[i].pending = 0;
+        pipes_[i].eof = false;
+    }
+}
+
+void PuttleProxy::splice_transfer(Direction direction) {
+    Pipe& pipe = pipes_[direction];
+    int from = source(direction).native_handle();
+    int to = sink(direction).native_handle();
+
+    for (int round = 0; round < SPLICE_ROUNDS; ++round) {
+        // Flush what is still sitting in the pipe before pulling more data
+        while (pipe.pending > 0) {
+            ssize_t n = splice(pipe.fds[0], NULL, to, NULL, pipe.pending,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN) {
+                    sink(direction).async_write_some(boost::asio::null_buffers(),
+                                                     boost::bind(&PuttleProxy::handle_splice, shared_from_this(),
+                                                             direction, boost::asio::placeholders::error));
+                } else {
+                    log.debug("splice to peer failed: %s", strerror(errno));
+                    set_close_reason(AccessRecord::CLOSE_ERROR);
+                    shutdown();
+                }
+                return;
+            }
+            pipe.pending -= n;
+        }
+
+        if (pipe.eof) {
+            finish_direction(direction);
+            return;
+        }
+
+        ssize_t n = splice(from, NULL, pipe.fds[1], NULL, SPLICE_SIZE,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0) {
+            // Flush the pipe in the next round first
+            pipe.eof = true;
+            continue;
+        } else if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                // Drained: wait for the next edge
+                source(direction).async_read_some(boost::asio::null_buffers(),
+                                                  boost::bind(&PuttleProxy::handle_splice, shared_from_this(),
+                                                          direction, boost::asio::placeholders::error));
+            } else {
+                log.debug("splice from peer failed: %s", strerror(errno));
+                set_close_reason(AccessRecord::CLOSE_ERROR);
+                shutdown();
+            }
+            return;
+        }
+        pipe.pending += n;
+        count_bytes(direction, n);
+    }
+
+    // Still busy: give the other connections of this io_service a chance
+    io_service_.post(boost::bind(&PuttleProxy::handle_splice, shared_from_this(),
+                                 direction, boost::system::error_code()));
+}
+
+void PuttleProxy::handle_splice(Direction direction, const boost::system::error_code& error) {
+    if (!error && client_socket_.is_open() && server_socket_.is_open()) {
+        splice_transfer(direction);
     } else {
+        set_close_reason(AccessRecord::CLOSE_ERROR);
         shutdown();
     }
 }
 
+void PuttleProxy::count_bytes(Direction direction, size_t bytes) {
+    if (direction == UPSTREAM) {
+        record_.bytes_up += bytes;
+        proxy_metrics_->bytes_up.add(bytes);
+    } else {
+        record_.bytes_down += bytes;
+        proxy_metrics_->bytes_down.add(bytes);
+    }
+}
+
+void PuttleProxy::set_close_reason(AccessRecord::CloseReason reason) {
+    // The first cause wins, closing the sockets fails the pending operations
+    if (record_.reason == AccessRecord::CLOSE_UNKNOWN)
+        record_.reason = reason;
+}
+
+void PuttleProxy::closed_by(Direction direction, const boost::system::error_code& error) {
+    if (error != boost::asio::error::eof)
+        set_close_reason(AccessRecord::CLOSE_ERROR);
+    else if (direction == UPSTREAM)
+        set_close_reason(AccessRecord::CLOSE_CLIENT);
+    else
+        set_close_reason(AccessRecord::CLOSE_SERVER);
+}
+
+void PuttleProxy::log_access() {
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+
+    record_.start = (accepted_ - epoch).total_microseconds();
+    record_.duration = (now - accepted_).total_microseconds();
+    if (!established_.is_not_a_date_time())
+        record_.setup = (established_ - accepted_).total_microseconds();
+
+    access_log_->write(record_);
+}
+
 void PuttleProxy::shutdown_error() {
     /* TODO: Provide an error message */
     shutdown();
 }
 
+void PuttleProxy::release_buffers() {
+    pool_.release(response_buffer_);
+    pool_.release(early_buffer_);
+    early_size_ = 0;
+
+    for (int i = UPSTREAM; i <= DOWNSTREAM; ++i) {
+        Channel& channel = channels_[i];
+        for (std::deque<Chunk>::iterator it = channel.ready.begin();
+                it != channel.ready.end(); ++it) {
+            pool_.release(it->buffer);
+        }
+        channel.ready.clear();
+        channel.writing = 0;
+    }
+}
+
 void PuttleProxy::shutdown() {
+    if (access_log_ != NULL) {
+        log_access();
+        access_log_ = NULL;
+    }
+
+    if (forwarding_) {
+        (*it_proxy)->stats->tunnel_closed();
+        proxy_metrics_->closed.add();
+        forwarding_ = false;
+    }
+
     client_socket_.close();
     server_socket_.close();
+    close_pipes();
+    release_buffers();
 }
 }
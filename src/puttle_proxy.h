@@ -25,13 +25,23 @@
 #include <authenticator.h>
 #include <logger.h>
 #include <proxy.h>
-
+#include <settings.h>
+#include <buffer_pool.h>
+#include <http_parser.h>
+#include <connector.h>
+#include <connect_request.h>
+#include <access_log.h>
+#include <metrics.h>
+#include <memory_budget.h>
+
+#include <deque>
 #include <map>
 #include <string>
 #include <vector>
 
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/array.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 namespace puttle {
 
@@ -42,18 +52,25 @@ class PuttleProxy : public boost::enable_shared_from_this<PuttleProxy> {
 public:
 
     enum _CONSTANTS {
-        BUFFER_SIZE = 8192
+        BUFFER_SIZE = 8192,
+        EARLY_SIZE = 16384,  // Client bytes sent along with the CONNECT request, a TLS record
+        SPLICE_SIZE = 65536,
+        SPLICE_ROUNDS = 16,
+        SHRINK_AFTER = 8,  // Consecutive small reads before a channel buffer shrinks
+        MAX_DRAIN_SIZE = 65536  // Larger 407 bodies are not worth keeping the connection
     };
 
     typedef boost::shared_ptr<PuttleProxy> pointer;
     typedef std::map<std::string, std::string> headers_map;
+    typedef boost::array<boost::asio::const_buffer, ConnectRequest::BUFFER_COUNT + 1> request_buffers;
 
-    static pointer create(boost::asio::io_service& io_service, const proxy_vector& proxies) {  // NOLINT
-        return pointer(new PuttleProxy(io_service, proxies));
+    static pointer create(boost::asio::io_service& io_service, const proxy_vector& proxies,  // NOLINT
+                          const Settings& settings) {
+        return pointer(new PuttleProxy(io_service, proxies, settings));
     }
 
-    explicit PuttleProxy(boost::asio::io_service& io_service, // NOLINT
-                         proxy_vector proxies);
+    PuttleProxy(boost::asio::io_service& io_service, // NOLINT
+                proxy_vector proxies, const Settings& settings);
     ~PuttleProxy();
 
     tcp::socket& socket();
@@ -64,47 +81,149 @@ private:
 
     typedef proxy_vector::iterator proxy_iterator;
 
-    void resolve_destination();
+    typedef enum {
+        UPSTREAM = 0,    // client_socket_ -> server_socket_
+        DOWNSTREAM = 1,  // server_socket_ -> client_socket_
+    } Direction;
+
+    // Kernel pipe used to splice() one direction of the tunnel
+    struct Pipe {
+        Pipe() : pending(0), eof(false) {
+            fds[0] = fds[1] = -1;
+        }
+
+        int fds[2];
+        size_t pending;
+        bool eof;  // The source is done, the pipe is flushed before passing it on
+    };
+
+    struct Chunk {
+        Chunk(const BufferPool::Buffer& buffer_, size_t length_) :
+            buffer(buffer_), length(length_) {
+        }
+
+        BufferPool::Buffer buffer;
+        size_t length;
+    };
+
+    /* One direction of the copy relay: chunks are read from the source
+     * while earlier ones are still being written to the sink, up to
+     * Settings::relay_window chunks in flight. Buffers are only taken from
+     * the pool once the source is readable, an idle channel holds none.
+     *
+     * The buffer size follows the flow: it doubles each time a read fills
+     * the buffer and halves after SHRINK_AFTER reads using less than a
+     * quarter of it, within [Settings::buffer_min, Settings::buffer_max].
+     *
+     * Once the source reached EOF, the chunks still ready are written
+     * before the sink is shut down for writing.
+     */
+    struct Channel {
+        Channel() : waiting(false), eof(false), writing(0), buffer_size(0), small_reads(0) {
+        }
+
+        std::deque<Chunk> ready;                     // Read, waiting for (or being) written
+        std::vector<boost::asio::const_buffer> gather;
+        bool waiting;                                // Readiness wait pending on the source
+        bool eof;                                    // No more reads, the source is done
+        size_t writing;                              // Chunks of `ready` in the pending write
+        size_t buffer_size;
+        size_t small_reads;
+    };
+
+    bool lookup_destination();
+    void connect_proxy();
+    void connect_upstream();
     void setup_proxy();
+    void read_early_data();
 
     void handle_proxy_connect(const boost::system::error_code& error);
+    void read_proxy_response();
     void handle_proxy_response(const boost::system::error_code& error,
                                size_t bytes_transferred);
 
-    void handle_resolve(const boost::system::error_code& error,
-                        tcp::resolver::iterator endpoint_iterator);
-    void handle_connect(const boost::system::error_code& error,
-                        tcp::resolver::iterator endpoint_iterator);
+    void handle_upstream_connect(const boost::system::error_code& error, size_t candidate,
+                                 Connector::socket_ptr socket, bool fast_open);
 
 
-    void handle_server_read(const boost::system::error_code& error,
-                            size_t bytes_transferred);
-    void handle_client_read(const boost::system::error_code& error,
-                            size_t bytes_transferred);
-    void handle_client_write(const boost::system::error_code& error);
-    void handle_server_write(const boost::system::error_code& error);
+    void handle_early_write(const boost::system::error_code& error);
+    void start_relays();
+
+    void relay_read(Direction direction);
+    void relay_write(Direction direction);
+    void handle_relay_ready(Direction direction, const boost::system::error_code& error);
+    void adapt_buffer_size(Direction direction, size_t bytes_transferred, size_t capacity);
+    void handle_relay_write(Direction direction, const boost::system::error_code& error);
+
+    void finish_direction(Direction direction);
+
+    tcp::socket& source(Direction direction);
+    tcp::socket& sink(Direction direction);
+
+    bool open_pipes();
+    void close_pipes();
+    void splice_transfer(Direction direction);
+    void handle_splice(Direction direction, const boost::system::error_code& error);
 
     void check_proxy_response();
+    static bool proxy_failed(int http_status);
     void handle_proxy_auth();
+    void copy_headers();
+    bool proxy_keeps_alive() const;
+    bool reuse_proxy_connection();
+    void drain_proxy_body(const char* data, size_t size);
+    void handle_proxy_drain(const boost::system::error_code& error,
+                            size_t bytes_transferred);
+    void reconnect_proxy();
 
+    void count_bytes(Direction direction, size_t bytes);
+    void set_close_reason(AccessRecord::CloseReason reason);
+    void closed_by(Direction direction, const boost::system::error_code& error);
+    void log_access();
+
+    void release_buffers();
     void shutdown();
     void shutdown_error();
 
     void log_headers(const Logger::Priority& priority, std::string context, const headers_map& headers);
 
+    boost::asio::io_service& io_service_;
+    const Settings& settings_;
     tcp::socket client_socket_;
     tcp::socket server_socket_;
-    tcp::resolver resolver_;
     Authenticator::pointer authenticator_;
 
-    boost::array<char, BUFFER_SIZE> client_data_;
-    boost::array<char, BUFFER_SIZE> server_data_;
+    static const std::string no_authorization;
+
+    ConnectRequest request_;
+    BufferPool& pool_;
+    MemoryBudget& budget_;
+    size_t charged_;  // Connection state charged to budget_
+    BufferPool::Buffer response_buffer_;
+    BufferPool::Buffer early_buffer_;  // Client bytes replayed after each CONNECT request until the 200
+    size_t early_size_;
+    bool reused_;  // server_socket_ was used before: taken from the pool or kept after a 407
+    bool fast_open_;  // server_socket_ connected with TCP Fast Open, the handshake went with the request
+    ResponseParser response_;  // Views into response_buffer_
+    size_t received_;          // Bytes of the proxy answer in response_buffer_
+    BodyDrain drain_;
+    boost::posix_time::ptime request_sent_;  // Time of the last CONNECT request
+    bool forwarding_;  // Counted in the active tunnels of the proxy
+    int finished_;     // Directions whose EOF was passed on, the tunnel closes at 2
+    Channel channels_[2];
+    Pipe pipes_[2];
     proxy_vector proxies_;
     proxy_iterator it_proxy;
 
+    Metrics& metrics_;
+    Metrics::ProxyMetrics* proxy_metrics_;  // Of *it_proxy, once a request is sent
+    AccessLog* access_log_;  // NULL unless the access log is enabled
+    AccessRecord record_;    // Filled along the life of the tunnel
+    boost::posix_time::ptime accepted_;
+    boost::posix_time::ptime established_;
+
     std::string dest_host_;
     std::string dest_port_;
-    std::string server_headers_;
     headers_map headers_;
     Logger::Log log;
 };
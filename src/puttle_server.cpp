@@ -22,35 +22,204 @@
 #include <puttle_proxy.h>
 #include <authenticator.h>
 #include <proxy.h>
+#include <upstream_pool.h>
+#include <resolve_cache.h>
+#include <circuit_breaker.h>
+#include <socket_options.h>
+#include <access_log.h>
+#include <metrics.h>
+#include <memory_budget.h>
 
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
 #include <string>
 #include <vector>
 
 namespace puttle {
 
-PuttleServer::PuttleServer(const ios_deque& io_services, int port, const proxy_vector& proxies)
+PuttleServer::PuttleServer(const ios_deque& io_services, int port, const proxy_vector& proxies,
+                           const Settings& settings)
     : io_services_(io_services),
-      acceptor_(*io_services.front(), boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port)),
-      proxies_(proxies) {
+      proxies_(proxies),
+      settings_(settings),
+      log(Logger::get_logger("puttle.server")) {
+    ResolveCache::instance().set_ttl(settings_.resolve_ttl, settings_.resolve_negative_ttl);
+
+    for (proxy_vector::const_iterator it = proxies_.begin(); it != proxies_.end(); ++it)
+        (*it)->breaker->configure(settings_.breaker_failures, settings_.breaker_cooldown);
+
+    for (ios_deque::const_iterator it = io_services_.begin(); it != io_services_.end(); ++it) {
+        Metrics::get(**it).init(proxies_);
+        MemoryBudget::get(**it).set_limit(settings_.memory_budget * 1024 * 1024 / io_services_.size());
+    }
+
+    check_socket_profile("client", settings_.client_socket);
+    check_socket_profile("upstream", settings_.upstream_socket);
+    if (settings_.fast_open)
+        check_fast_open();
+
+    if (settings_.metrics_port > 0 || !settings_.metrics_socket.empty())
+        metrics_server_.reset(new MetricsServer(*io_services_.front(), io_services_, proxies_, settings_));
+
+    if (!settings_.access_log.empty()) {
+        for (size_t i = 0; i < io_services_.size(); ++i)
+            AccessLog::get(*io_services_[i]).open(settings_, i);
+    }
+
+    if (settings_.upstream_pool_size > 0) {
+        for (ios_deque::const_iterator it = io_services_.begin(); it != io_services_.end(); ++it)
+            UpstreamPool::get(**it).start(proxies_, settings_);
+    }
+
+    if (settings_.reuse_port) {
+        for (ios_deque::const_iterator it = io_services_.begin(); it != io_services_.end(); ++it)
+            open_listener(*it, port);
+    } else {
+        open_listener(io_services_.front(), port);
+    }
+
+    for (size_t i = 0; i < listeners_.size(); ++i)
+        start_accept(i);
+}
+
+/* Tries `profile` once on a scratch socket: the tunnels apply it on a best
+ * effort basis and only report failures at the debug level.
+ */
+void PuttleServer::check_socket_profile(const char* side, const SocketProfile& profile) {
+    tcp::socket socket(*io_services_.front());
+    socket.open(tcp::v4());
+
+    boost::system::error_code error = apply_socket_profile(socket, profile);
+    if (error)
+        log.error("The %s socket profile cannot be fully applied: %s", side, error.message().c_str());
+}
+
+void PuttleServer::check_fast_open() {
+    tcp::socket socket(*io_services_.front());
+    socket.open(tcp::v4());
+
+    boost::system::error_code error = enable_fast_open(socket);
+    if (error)
+        log.error("TCP Fast Open is not available, connecting to the proxies normally: %s",
+                  error.message().c_str());
+}
+
+void PuttleServer::open_listener(io_service_ptr io_service, int port) {
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    acceptor_ptr acceptor(new tcp::acceptor(*io_service));
+
+    acceptor->open(endpoint.protocol());
     boost::asio::socket_base::reuse_address reuse_address(true);
-    acceptor_.set_option(reuse_address);
-    start_accept();
+    acceptor->set_option(reuse_address);
+    if (settings_.reuse_port) {
+        reuse_port option(true);
+        acceptor->set_option(option);
+    }
+    // Accepted sockets inherit the buffer sizes, which must be set before the handshake
+    if (settings_.client_socket.send_buffer > 0)
+        acceptor->set_option(boost::asio::socket_base::send_buffer_size(settings_.client_socket.send_buffer));
+    if (settings_.client_socket.receive_buffer > 0)
+        acceptor->set_option(boost::asio::socket_base::receive_buffer_size(settings_.client_socket.receive_buffer));
+    acceptor->bind(endpoint);
+    acceptor->listen();
+    acceptor->non_blocking(true);
+
+    timer_ptr timer(new boost::asio::deadline_timer(*io_service));
+    listeners_.push_back(Listener(io_service, acceptor, timer));
+}
+
+void PuttleServer::start_accept(size_t listener) {
+    listeners_[listener].acceptor->async_wait(tcp::acceptor::wait_read,
+                                              boost::bind(&PuttleServer::handle_accept, this, listener,
+                                                          boost::asio::placeholders::error));
 }
 
-void PuttleServer::start_accept() {
-    io_services_.push_back(io_services_.front());
-    io_services_.pop_front();
-    PuttleProxy::pointer new_proxy = PuttleProxy::create(*io_services_.front(), proxies_);
+void PuttleServer::handle_accept(size_t listener, const boost::system::error_code& error) {
+    if (error)
+        return;
+
+    Listener& l = listeners_[listener];
+
+    // Leave the connections in the backlog until the tunnels free some memory
+    if (memory_exhausted()) {
+        if (!l.paused)
+            log.warn("The memory budget is used up, pausing the accepts");
+        l.paused = true;
+        Metrics::get(*l.io_service).accept_pauses.add();
+        retry_accept(listener);
+        return;
+    } else if (l.paused) {
+        log.warn("Accepting connections again");
+        l.paused = false;
+    }
+
+    // Drain the backlog, up to accept_batch connections per wakeup
+    for (size_t i = 0; i < settings_.accept_batch; ++i) {
+        int fd = accept4(l.acceptor->native_handle(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            // Most likely out of descriptors, give the tunnels some time to close
+            log.error("Unable to accept a connection: %s", strerror(errno));
+            retry_accept(listener);
+            return;
+        }
 
-    acceptor_.async_accept(new_proxy->socket(),
-                           boost::bind(&PuttleServer::handle_accept, this, new_proxy,
-                                       boost::asio::placeholders::error));
+        dispatch(listener, fd);
+    }
+
+    start_accept(listener);
 }
 
-void PuttleServer::handle_accept(PuttleProxy::pointer new_proxy, const boost::system::error_code& error) {
-    if (!error) {
-        new_proxy->init_forward();
-        start_accept();
+void PuttleServer::retry_accept(size_t listener) {
+    Listener& l = listeners_[listener];
+    l.timer->expires_from_now(boost::posix_time::milliseconds(static_cast<long>(ACCEPT_RETRY)));
+    l.timer->async_wait(boost::bind(&PuttleServer::handle_accept, this, listener,
+                                    boost::asio::placeholders::error));
+}
+
+// Connections go to every io_service, so the budget is checked as a whole
+bool PuttleServer::memory_exhausted() const {
+    if (settings_.memory_budget == 0)
+        return false;
+
+    size_t used = 0;
+    for (ios_deque::const_iterator it = io_services_.begin(); it != io_services_.end(); ++it)
+        used += MemoryBudget::get(**it).used();
+    return used >= settings_.memory_budget * 1024 * 1024;
+}
+
+void PuttleServer::dispatch(size_t listener, int fd) {
+    io_service_ptr io_service = listeners_[listener].io_service;
+
+    if (!settings_.reuse_port) {
+        io_services_.push_back(io_services_.front());
+        io_services_.pop_front();
+        io_service = io_services_.front();
     }
+
+    // The tunnel is created on the thread which will serve it: the pools,
+    // budgets and metrics of an io_service are only used from its thread,
+    // and the acceptor thread never holds a reference to the tunnel
+    io_service->dispatch(boost::bind(&PuttleServer::start_tunnel, this, io_service, fd));
+}
+
+void PuttleServer::start_tunnel(io_service_ptr io_service, int fd) {
+    PuttleProxy::pointer new_proxy = PuttleProxy::create(*io_service, proxies_, settings_);
+
+    boost::system::error_code error;
+    new_proxy->socket().assign(tcp::v4(), fd, error);
+    if (error) {
+        log.error("Unable to register an accepted connection: %s", error.message().c_str());
+        ::close(fd);
+        return;
+    }
+
+    new_proxy->init_forward();
 }
 }
@@ -25,11 +25,16 @@
 #include <puttle_proxy.h>
 #include <authenticator.h>
 #include <proxy.h>
+#include <settings.h>
+#include <logger.h>
+#include <metrics_server.h>
 
 #include <string>
 #include <vector>
 #include <deque>
 
+#include <boost/scoped_ptr.hpp>
+
 namespace puttle {
 
 using ::boost::asio::ip::tcp;
@@ -37,17 +42,63 @@ using ::boost::asio::ip::tcp;
 typedef boost::shared_ptr<boost::asio::io_service> io_service_ptr;
 typedef std::deque<io_service_ptr> ios_deque;
 
+/* Accepts the redirected connections and hands them to a PuttleProxy.
+ *
+ * By default a single acceptor runs on the first io_service and the
+ * accepted connections are spread over all of them in turn. With
+ * Settings::reuse_port every io_service has its own acceptor bound to the
+ * same port with SO_REUSEPORT: the kernel spreads the connections and
+ * each one stays on the thread which accepted it.
+ *
+ * Acceptors are non-blocking: every time one becomes readable, up to
+ * Settings::accept_batch pending connections are taken from its backlog
+ * with accept4() before waiting again.
+ *
+ * Settings::memory_budget is shared evenly between the io_services. While
+ * the tunnels use all of it, the acceptors leave the new connections in
+ * the backlog and look again every ACCEPT_RETRY milliseconds.
+ */
 class PuttleServer {
 public:
 
-    PuttleServer(const ios_deque& io_services, int port, const proxy_vector& proxies);
-    void start_accept();
+    enum _CONSTANTS {
+        ACCEPT_RETRY = 100  // Milliseconds before accepting again after an error or past the budget
+    };
+
+    PuttleServer(const ios_deque& io_services, int port, const proxy_vector& proxies,
+                 const Settings& settings);
 
 private:
-    void handle_accept(PuttleProxy::pointer new_proxy, const boost::system::error_code& error);
+    typedef boost::shared_ptr<tcp::acceptor> acceptor_ptr;
+    typedef boost::shared_ptr<boost::asio::deadline_timer> timer_ptr;
+
+    struct Listener {
+        Listener(io_service_ptr io_service_, acceptor_ptr acceptor_, timer_ptr timer_) :
+            io_service(io_service_), acceptor(acceptor_), timer(timer_), paused(false) {
+        }
+
+        io_service_ptr io_service;  // Runs the accepted connections, unless shared
+        acceptor_ptr acceptor;
+        timer_ptr timer;            // Delays the next accept after an error or past the memory budget
+        bool paused;                // Past the memory budget
+    };
+
+    void check_socket_profile(const char* side, const SocketProfile& profile);
+    void check_fast_open();
+    void open_listener(io_service_ptr io_service, int port);
+    void start_accept(size_t listener);
+    void handle_accept(size_t listener, const boost::system::error_code& error);
+    bool memory_exhausted() const;
+    void retry_accept(size_t listener);
+    void dispatch(size_t listener, int fd);
+    void start_tunnel(io_service_ptr io_service, int fd);
+
     ios_deque io_services_;
-    tcp::acceptor acceptor_;
+    std::vector<Listener> listeners_;
     const proxy_vector& proxies_;
+    const Settings& settings_;
+    boost::scoped_ptr<MetricsServer> metrics_server_;
+    Logger::Log log;
 };
 }
 
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <resolve_cache.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace puttle {
+
+ResolveCache::ResolveCache() :
+    ttl_(60),
+    negative_ttl_(5),
+    log(Logger::get_logger("puttle.resolve-cache")) {
+}
+
+void ResolveCache::set_ttl(long ttl, long negative_ttl) {
+    ttl_ = ttl;
+    negative_ttl_ = negative_ttl;
+}
+
+ResolveCache::Shard& ResolveCache::shard(const std::string& key) {
+    return shards_[boost::hash<std::string>()(key) % SHARDS];
+}
+
+void ResolveCache::async_resolve(boost::asio::io_service& io_service, const std::string& host,  // NOLINT
+                                 uint16_t port, handler h) {
+    std::string key = host + ":" + boost::lexical_cast<std::string>(port);
+    Shard& s = shard(key);
+    boost::posix_time::ptime current = now();
+    bool refresh = false;
+
+    {
+        boost::mutex::scoped_lock lock(s.mutex);
+        Entry& entry = s.entries[key];
+
+        if (!entry.expires.is_not_a_date_time()) {
+            bool fresh = current < entry.expires;
+            bool usable_stale = !entry.error &&
+                                current < entry.expires + boost::posix_time::seconds(ttl_);
+
+            if (fresh || usable_stale) {
+                bool may_retry = entry.retry.is_not_a_date_time() || current >= entry.retry;
+                if (!fresh && !entry.resolving && may_retry) {
+                    entry.resolving = true;
+                    refresh = true;
+                }
+                io_service.post(boost::bind(h, entry.error, entry.results));
+                if (!refresh)
+                    return;
+            }
+        }
+
+        if (!refresh) {
+            // Nothing usable: wait for the pending resolution or start one
+            entry.waiters.push_back(Waiter(&io_service, h));
+            if (entry.resolving)
+                return;
+            entry.resolving = true;
+        }
+    }
+
+    if (refresh)
+        log.debug("Refreshing %s", key.c_str());
+    start_resolve(io_service, key, host, port);
+}
+
+void ResolveCache::start_resolve(boost::asio::io_service& io_service, const std::string& key,  // NOLINT
+                                 const std::string& host, uint16_t port) {
+    resolver_ptr resolver(new tcp::resolver(io_service));
+    tcp::resolver::query query(host, boost::lexical_cast<std::string>(port));
+    resolver->async_resolve(query,
+                            boost::bind(&ResolveCache::handle_resolve, this, resolver, key,
+                                        boost::asio::placeholders::error,
+                                        boost::asio::placeholders::iterator));
+}
+
+void ResolveCache::handle_resolve(resolver_ptr resolver, std::string key,
+                                  const boost::system::error_code& error,
+                                  tcp::resolver::iterator endpoint_iterator) {
+    Shard& s = shard(key);
+    std::vector<Waiter> waiters;
+
+    {
+        boost::mutex::scoped_lock lock(s.mutex);
+        Entry& entry = s.entries[key];
+
+        // A failed refresh keeps serving the previous answer until it is too old
+        bool keep_stale = error && !entry.error && !entry.expires.is_not_a_date_time() &&
+                          now() < entry.expires + boost::posix_time::seconds(ttl_);
+        if (keep_stale) {
+            // Like a negative entry, or every lookup would start a resolution
+            entry.retry = now() + boost::posix_time::seconds(negative_ttl_);
+        } else {
+            entry.results = endpoint_iterator;
+            entry.error = error;
+            entry.expires = now() + boost::posix_time::seconds(error ? negative_ttl_ : ttl_);
+            entry.retry = boost::posix_time::ptime();
+        }
+        entry.resolving = false;
+        waiters.swap(entry.waiters);
+    }
+
+    if (error)
+        log.debug("Unable to resolve %s: %s", key.c_str(), error.message().c_str());
+
+    for (std::vector<Waiter>::const_iterator it = waiters.begin(); it != waiters.end(); ++it)
+        it->io_service->post(boost::bind(it->h, error, endpoint_iterator));
+}
+
+boost::posix_time::ptime ResolveCache::now() {
+    return boost::posix_time::microsec_clock::universal_time();
+}
+}
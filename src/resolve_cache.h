@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_RESOLVE_CACHE_H
+#define PUTTLE_SRC_RESOLVE_CACHE_H
+
+#include <puttle-common.h>
+#include <logger.h>
+#include <singleton.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace puttle {
+
+using boost::asio::ip::tcp;
+
+/* Process-wide cache of the proxy host resolutions.
+ *
+ * Results are kept for `ttl` seconds and failures for `negative_ttl`
+ * seconds. An expired positive entry is still served for another `ttl`
+ * seconds while a single background resolution refreshes it, and
+ * concurrent misses on the same host wait for the same resolution. A
+ * failed refresh is only tried again after `negative_ttl` seconds.
+ *
+ * Entries are spread over SHARDS independently locked maps, so threads
+ * resolving different hosts never contend and the lock is only held
+ * while the map is read or updated, never during a resolution.
+ */
+class ResolveCache : public Singleton<ResolveCache> {
+    friend class Singleton<ResolveCache>;
+public:
+    typedef boost::function<void (const boost::system::error_code&, tcp::resolver::iterator)> handler;
+
+    enum _CONSTANTS {
+        SHARDS = 16
+    };
+
+    void set_ttl(long ttl, long negative_ttl);
+
+    /* Resolves host:port, `h` is always invoked through `io_service`,
+     * never from within this call.
+     */
+    void async_resolve(boost::asio::io_service& io_service, const std::string& host,  // NOLINT
+                       uint16_t port, handler h);
+
+private:
+    typedef boost::shared_ptr<tcp::resolver> resolver_ptr;
+
+    struct Waiter {
+        Waiter(boost::asio::io_service* io_service_, handler h_) :
+            io_service(io_service_), h(h_) {
+        }
+
+        boost::asio::io_service* io_service;
+        handler h;
+    };
+
+    struct Entry {
+        Entry() : resolving(false) {
+        }
+
+        tcp::resolver::iterator results;
+        boost::system::error_code error;
+        boost::posix_time::ptime expires;  // Not a date time until resolved once
+        boost::posix_time::ptime retry;    // No refresh before, after a failed one
+        bool resolving;
+        std::vector<Waiter> waiters;
+    };
+
+    struct Shard {
+        boost::mutex mutex;
+        std::map<std::string, Entry> entries;
+    };
+
+    ResolveCache();
+
+    Shard& shard(const std::string& key);
+    void start_resolve(boost::asio::io_service& io_service, const std::string& key,  // NOLINT
+                       const std::string& host, uint16_t port);
+    void handle_resolve(resolver_ptr resolver, std::string key,
+                        const boost::system::error_code& error,
+                        tcp::resolver::iterator endpoint_iterator);
+
+    static boost::posix_time::ptime now();
+
+    Shard shards_[SHARDS];
+    long ttl_;
+    long negative_ttl_;
+    Logger::Log log;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_RESOLVE_CACHE_H */
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <settings.h>
+#include <buffer_pool.h>
+
+#include <map>
+#include <string>
+
+#include <boost/assign.hpp>
+
+namespace puttle {
+
+std::map<std::string, Settings::RelayMode> Settings::relay_mode_names = boost::assign::map_list_of
+        ("copy", Settings::RELAY_COPY)
+        ("splice", Settings::RELAY_SPLICE);
+
+std::map<std::string, Settings::ProxySelection> Settings::proxy_selection_names = boost::assign::map_list_of
+        ("random", Settings::SELECT_RANDOM)
+        ("p2c", Settings::SELECT_P2C)
+        ("least-loaded", Settings::SELECT_LEAST_LOADED);
+
+Settings::Settings() :
+    reuse_port(false),
+    accept_batch(64),
+    relay_mode(RELAY_COPY),
+    relay_window(4),
+    buffer_min(8192),
+    buffer_max(BufferPool::MAX_SIZE),
+    memory_budget(0),
+    upstream_pool_size(0),
+    upstream_pool_idle(30),
+    resolve_ttl(60),
+    resolve_negative_ttl(5),
+    connect_stagger(250),
+    fast_open(false),
+    early_data(false),
+    proxy_selection(SELECT_P2C),
+    breaker_failures(5),
+    breaker_cooldown(10),
+    access_log_size(64),
+    access_log_files(4),
+    metrics_port(0),
+    destination_address(0),
+    destination_port(0) {
+    client_socket.no_delay = true;
+    upstream_socket.no_delay = true;
+}
+
+Settings::RelayMode Settings::get_relay_mode(const std::string& mode) {
+    std::map<std::string, RelayMode>::const_iterator it = relay_mode_names.find(mode);
+    if (it != relay_mode_names.end())
+        return it->second;
+    else
+        return Settings::RELAY_INVALID;
+}
+
+Settings::ProxySelection Settings::get_proxy_selection(const std::string& selection) {
+    std::map<std::string, ProxySelection>::const_iterator it = proxy_selection_names.find(selection);
+    if (it != proxy_selection_names.end())
+        return it->second;
+    else
+        return Settings::SELECT_INVALID;
+}
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_SETTINGS_H
+#define PUTTLE_SRC_SETTINGS_H
+
+#include <puttle-common.h>
+#include <socket_options.h>
+
+#include <map>
+#include <string>
+
+namespace puttle {
+
+/* Runtime tunables shared by the server and every forwarded connection.
+ * Filled once by main() before the first connection is accepted, read-only
+ * afterwards.
+ */
+struct Settings {
+public:
+    typedef enum {
+        RELAY_COPY,
+        RELAY_SPLICE,
+        RELAY_INVALID,
+    } RelayMode;
+
+    typedef enum {
+        SELECT_RANDOM,
+        SELECT_P2C,
+        SELECT_LEAST_LOADED,
+        SELECT_INVALID,
+    } ProxySelection;
+
+    Settings();
+
+    static RelayMode get_relay_mode(const std::string& mode);
+    static ProxySelection get_proxy_selection(const std::string& selection);
+
+    bool reuse_port;      // One acceptor per io_service instead of a shared one
+    size_t accept_batch;  // Connections accepted per readiness notification
+    RelayMode relay_mode;
+    size_t relay_window;  // Chunks in flight per direction of the copy relay
+    size_t buffer_min;    // Bounds of the adaptive relay buffers, in bytes
+    size_t buffer_max;
+    size_t memory_budget;  // MiB for the tunnels of the whole process, 0 is unlimited
+    size_t upstream_pool_size;  // Idle connections kept per proxy and io_service
+    long upstream_pool_idle;    // Seconds before an idle pooled connection is dropped
+    long resolve_ttl;           // Seconds a proxy host resolution is cached
+    long resolve_negative_ttl;  // Seconds a failed resolution is cached
+    long connect_stagger;       // Milliseconds before racing the next proxy endpoint
+    bool fast_open;             // Send the CONNECT request in the SYN (TCP Fast Open)
+    bool early_data;            // Send the first client bytes right after the CONNECT request
+    ProxySelection proxy_selection;
+    size_t breaker_failures;  // Consecutive failures skipping a proxy, 0 never skips
+    long breaker_cooldown;    // Seconds a failing proxy is skipped before being probed
+    std::string access_log;   // Path prefix of the binary access log, empty disables it
+    size_t access_log_size;   // MiB per access log file
+    size_t access_log_files;  // Rotated access log files kept per thread
+    int metrics_port;             // Loopback port of the metrics endpoint, 0 disables it
+    std::string metrics_socket;   // Unix socket of the metrics endpoint, empty disables it
+    uint32_t destination_address;  // Replaces SO_ORIGINAL_DST when destination_port is set,
+    uint16_t destination_port;     // host byte order (tests without iptables)
+    SocketProfile client_socket;    // TCP options of the accepted connections
+    SocketProfile upstream_socket;  // TCP options of the connections to the proxies
+
+private:
+    static std::map<std::string, RelayMode> relay_mode_names;
+    static std::map<std::string, ProxySelection> proxy_selection_names;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_SETTINGS_H */
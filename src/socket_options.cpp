@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <socket_options.h>
+
+#include <netinet/tcp.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+// Older libc headers lack it
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+
+namespace puttle {
+
+typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPIDLE> keepalive_idle;
+typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPINTVL> keepalive_interval;
+typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPCNT> keepalive_count;
+typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_USER_TIMEOUT> user_timeout;
+typedef boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_NOTSENT_LOWAT> notsent_lowat;
+typedef boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_FASTOPEN_CONNECT> fastopen_connect;
+
+SocketProfile::SocketProfile() :
+    no_delay(false),
+    send_buffer(0),
+    receive_buffer(0),
+    notsent_lowat(0),
+    keepalive_idle(0),
+    keepalive_interval(0),
+    keepalive_count(0),
+    user_timeout(0) {
+}
+
+// Throws boost::bad_lexical_cast on negative values as well
+static int non_negative(const std::string& value) {
+    int n = boost::lexical_cast<int>(value);
+    if (n < 0)
+        throw boost::bad_lexical_cast();
+    return n;
+}
+
+bool SocketProfile::parse(const std::string& spec, SocketProfile* profile) {
+    SocketProfile p;
+    if (spec.empty() || spec == "default") {
+        *profile = p;
+        return true;
+    }
+
+    std::vector<std::string> items;
+    boost::split(items, spec, boost::is_any_of(","));
+
+    for (std::vector<std::string>::const_iterator it = items.begin(); it != items.end(); ++it) {
+        std::string name = boost::trim_copy(it->substr(0, it->find('=')));
+        std::string value = it->find('=') == std::string::npos ? "" : boost::trim_copy(it->substr(it->find('=') + 1));
+
+        try {
+            if (name == "nodelay")
+                p.no_delay = value.empty() || boost::lexical_cast<int>(value) != 0;
+            else if (name == "congestion" && !value.empty())
+                p.congestion = value;
+            else if (name == "sndbuf")
+                p.send_buffer = non_negative(value);
+            else if (name == "rcvbuf")
+                p.receive_buffer = non_negative(value);
+            else if (name == "notsent-lowat")
+                p.notsent_lowat = non_negative(value);
+            else if (name == "keepidle")
+                p.keepalive_idle = non_negative(value);
+            else if (name == "keepintvl")
+                p.keepalive_interval = non_negative(value);
+            else if (name == "keepcnt")
+                p.keepalive_count = non_negative(value);
+            else if (name == "user-timeout")
+                p.user_timeout = non_negative(value);
+            else
+                return false;
+        } catch(const boost::bad_lexical_cast& e) {
+            return false;
+        }
+    }
+
+    *profile = p;
+    return true;
+}
+
+template <typename Option>
+static void set_option(tcp::socket& socket, const Option& option,  // NOLINT
+                       boost::system::error_code* error) {
+    boost::system::error_code ec;
+    socket.set_option(option, ec);
+    if (ec)
+        *error = ec;
+}
+
+boost::system::error_code apply_socket_profile(tcp::socket& socket,  // NOLINT
+                                               const SocketProfile& profile) {
+    boost::system::error_code error;
+
+    if (profile.no_delay)
+        set_option(socket, tcp::no_delay(true), &error);
+    if (profile.send_buffer > 0)
+        set_option(socket, boost::asio::socket_base::send_buffer_size(profile.send_buffer), &error);
+    if (profile.receive_buffer > 0)
+        set_option(socket, boost::asio::socket_base::receive_buffer_size(profile.receive_buffer), &error);
+    if (profile.notsent_lowat > 0)
+        set_option(socket, notsent_lowat(profile.notsent_lowat), &error);
+
+    if (profile.keepalive_idle > 0 || profile.keepalive_interval > 0 || profile.keepalive_count > 0)
+        set_option(socket, boost::asio::socket_base::keep_alive(true), &error);
+    if (profile.keepalive_idle > 0)
+        set_option(socket, keepalive_idle(profile.keepalive_idle), &error);
+    if (profile.keepalive_interval > 0)
+        set_option(socket, keepalive_interval(profile.keepalive_interval), &error);
+    if (profile.keepalive_count > 0)
+        set_option(socket, keepalive_count(profile.keepalive_count), &error);
+
+    if (profile.user_timeout > 0)
+        set_option(socket, user_timeout(profile.user_timeout), &error);
+
+    if (!profile.congestion.empty() &&
+            setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_CONGESTION,
+                       profile.congestion.data(), profile.congestion.size()) != 0)
+        error = boost::system::error_code(errno, boost::system::system_category());
+
+    return error;
+}
+
+boost::system::error_code enable_fast_open(tcp::socket& socket) {  // NOLINT
+    boost::system::error_code error;
+    socket.set_option(fastopen_connect(true), error);
+    return error;
+}
+
+void open_upstream_socket(tcp::socket& socket, const tcp& protocol,  // NOLINT
+                          const SocketProfile& profile) {
+    // If the socket was previously opened, close it.
+    if (socket.is_open())
+        socket.close();
+
+    // Opens the socket so we can set the ttl option
+    socket.open(protocol);
+
+    if (protocol == tcp::v4()) {
+        time_to_live ttl(UPSTREAM_TTL);
+        socket.set_option(ttl);
+    } else {
+        boost::asio::ip::unicast::hops hops(UPSTREAM_TTL);
+        socket.set_option(hops);
+    }
+
+    boost::asio::socket_base::keep_alive keep_alive(true);
+    socket.set_option(keep_alive);
+
+    // Before connecting: the buffer sizes decide the window scale
+    apply_socket_profile(socket, profile);
+}
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_SOCKET_OPTIONS_H
+#define PUTTLE_SRC_SOCKET_OPTIONS_H
+
+#include <puttle-common.h>
+
+#include <string>
+
+namespace puttle {
+
+using boost::asio::ip::tcp;
+
+typedef boost::asio::detail::socket_option::integer<IPPROTO_IP, IP_TTL> time_to_live;
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+
+enum {
+    // setup-puttle does not redirect packets carrying this TTL, which keeps
+    // our own connections to the proxies out of the tunnel.
+    UPSTREAM_TTL = 42
+};
+
+/* TCP options applied to one side of the tunnels: the client sockets or
+ * the upstream ones. Zero (or empty) keeps the system default.
+ *
+ * Profiles are written as a comma separated list, e.g.
+ * "nodelay,sndbuf=262144,keepidle=60,congestion=bbr":
+ *
+ *   nodelay[=0|1]      TCP_NODELAY
+ *   sndbuf=BYTES       SO_SNDBUF
+ *   rcvbuf=BYTES       SO_RCVBUF
+ *   notsent-lowat=BYTES TCP_NOTSENT_LOWAT
+ *   keepidle=SECONDS   TCP_KEEPIDLE, enables SO_KEEPALIVE as do the two next ones
+ *   keepintvl=SECONDS  TCP_KEEPINTVL
+ *   keepcnt=COUNT      TCP_KEEPCNT
+ *   user-timeout=MS    TCP_USER_TIMEOUT
+ *   congestion=NAME    TCP_CONGESTION
+ *
+ * "default" (or an empty string) sets nothing.
+ */
+struct SocketProfile {
+    SocketProfile();
+
+    // Returns false if `spec` is invalid, `profile` is then left unchanged
+    static bool parse(const std::string& spec, SocketProfile* profile);
+
+    bool no_delay;
+    int send_buffer;
+    int receive_buffer;
+    int notsent_lowat;
+    int keepalive_idle;
+    int keepalive_interval;
+    int keepalive_count;
+    int user_timeout;
+    std::string congestion;
+};
+
+/* Applies `profile` to an open socket. Every option is tried, the error
+ * of the last one failing is returned.
+ */
+boost::system::error_code apply_socket_profile(tcp::socket& socket,  // NOLINT
+                                               const SocketProfile& profile);
+
+/* Defers the handshake of the next connect() of `socket` to its first
+ * write, which then travels in the SYN if the peer accepts TCP Fast Open
+ * (TCP_FASTOPEN_CONNECT, Linux 4.11). The kernel falls back to a plain
+ * handshake by itself when it holds no Fast Open cookie for the peer or
+ * the peer refuses it. Connecting completes at once: connection failures
+ * show up on the first read or write.
+ */
+boost::system::error_code enable_fast_open(tcp::socket& socket);  // NOLINT
+
+/* (Re)opens `socket` for a connection to an upstream proxy and applies
+ * the upstream socket options and `profile`. Throws
+ * boost::system::system_error if the socket cannot be opened, the
+ * profile is applied on a best effort basis.
+ */
+void open_upstream_socket(tcp::socket& socket, const tcp& protocol = tcp::v4(),  // NOLINT
+                          const SocketProfile& profile = SocketProfile());
+}
+
+#endif /* end of include guard: PUTTLE_SRC_SOCKET_OPTIONS_H */
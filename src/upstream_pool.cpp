@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <upstream_pool.h>
+#include <socket_options.h>
+#include <resolve_cache.h>
+
+#include <sys/socket.h>
+
+#include <vector>
+
+
+namespace puttle {
+
+boost::asio::io_service::id UpstreamPool::id;
+
+UpstreamPool::UpstreamPool(boost::asio::io_service& io_service)  // NOLINT
+    : boost::asio::io_service::service(io_service),
+      io_service_(io_service),
+      settings_(NULL),
+      timer_(io_service),
+      stopped_(false),
+      log(Logger::get_logger("puttle.upstream-pool")) {
+}
+
+void UpstreamPool::shutdown_service() {
+    stopped_ = true;
+    timer_.cancel();
+    slots_.clear();
+}
+
+void UpstreamPool::start(const proxy_vector& proxies, const Settings& settings) {
+    io_service_.post(boost::bind(&UpstreamPool::init, this, proxies, &settings));
+}
+
+void UpstreamPool::init(proxy_vector proxies, const Settings* settings) {
+    settings_ = settings;
+    for (proxy_vector::const_iterator it = proxies.begin(); it != proxies.end(); ++it)
+        slots_.push_back(Slot(*it));
+
+    for (size_t i = 0; i < slots_.size(); ++i)
+        fill(i);
+    schedule_maintenance();
+}
+
+UpstreamPool::socket_ptr UpstreamPool::take(const Proxy& proxy) {
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        Slot& slot = slots_[i];
+        if (slot.proxy.get() != &proxy)
+            continue;
+
+        // Most recently opened first, it is the least likely to be stale
+        while (!slot.idle.empty()) {
+            socket_ptr socket = slot.idle.back().socket;
+            slot.idle.pop_back();
+            if (is_alive(*socket)) {
+                fill(i);
+                return socket;
+            }
+        }
+        fill(i);
+        break;
+    }
+    return socket_ptr();
+}
+
+void UpstreamPool::fill(size_t slot) {
+    Slot& s = slots_[slot];
+    if (stopped_ || s.failed)
+        return;
+
+    for (size_t n = s.idle.size() + s.connecting; n < settings_->upstream_pool_size; ++n) {
+        ++s.connecting;
+        ResolveCache::instance().async_resolve(io_service_, s.proxy->host, s.proxy->port,
+                                               boost::bind(&UpstreamPool::handle_resolve, this, slot, _1, _2));
+    }
+}
+
+void UpstreamPool::handle_resolve(size_t slot, const boost::system::error_code& error,
+                                  tcp::resolver::iterator endpoint_iterator) {
+    if (stopped_)
+        return;
+
+    if (!error) {
+        socket_ptr socket(new tcp::socket(io_service_));
+        handle_connect(slot, socket, boost::asio::error::not_connected, endpoint_iterator);
+    } else {
+        Slot& s = slots_[slot];
+        log.debug("Unable to resolve %s:%u: %s", s.proxy->host.c_str(), s.proxy->port,
+                  error.message().c_str());
+        --s.connecting;
+        s.failed = true;
+    }
+}
+
+void UpstreamPool::handle_connect(size_t slot, socket_ptr socket,
+                                  const boost::system::error_code& error,
+                                  tcp::resolver::iterator endpoint_iterator) {
+    if (stopped_)
+        return;
+
+    Slot& s = slots_[slot];
+
+    if (!error) {
+        --s.connecting;
+        s.idle.push_back(Idle(socket, now()));
+    } else if (endpoint_iterator != tcp::resolver::iterator()) {
+        tcp::endpoint endpoint = *endpoint_iterator;
+        try {
+            open_upstream_socket(*socket, endpoint.protocol(), settings_->upstream_socket);
+            socket->async_connect(endpoint,
+                                  boost::bind(&UpstreamPool::handle_connect, this, slot, socket,
+                                              boost::asio::placeholders::error, ++endpoint_iterator));
+        } catch(const boost::system::system_error &e) {
+            log.errorStream() << "Could not open a socket: " << e.what();
+            --s.connecting;
+            s.failed = true;
+        }
+    } else {
+        log.debug("Unable to connect to %s:%u", s.proxy->host.c_str(), s.proxy->port);
+        --s.connecting;
+        s.failed = true;
+    }
+}
+
+void UpstreamPool::schedule_maintenance() {
+    timer_.expires_from_now(boost::posix_time::seconds(static_cast<long>(MAINTENANCE_INTERVAL)));
+    timer_.async_wait(boost::bind(&UpstreamPool::handle_maintenance, this,
+                                  boost::asio::placeholders::error));
+}
+
+void UpstreamPool::handle_maintenance(const boost::system::error_code& error) {
+    if (error || stopped_)
+        return;
+
+    expire();
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        slots_[i].failed = false;
+        fill(i);
+    }
+    schedule_maintenance();
+}
+
+void UpstreamPool::expire() {
+    boost::posix_time::ptime limit = now() - boost::posix_time::seconds(settings_->upstream_pool_idle);
+
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        std::deque<Idle>& idle = slots_[i].idle;
+        while (!idle.empty() && (idle.front().since < limit || !is_alive(*idle.front().socket)))
+            idle.pop_front();
+    }
+}
+
+bool UpstreamPool::is_alive(tcp::socket& socket) {  // NOLINT
+    // An idle proxy connection has nothing to read: EOF means the proxy
+    // closed it, data means it is out of sync.
+    char c;
+    ssize_t n = recv(socket.native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+boost::posix_time::ptime UpstreamPool::now() {
+    return boost::posix_time::microsec_clock::universal_time();
+}
+}
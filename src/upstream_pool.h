@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PUTTLE_SRC_UPSTREAM_POOL_H
+#define PUTTLE_SRC_UPSTREAM_POOL_H
+
+#include <puttle-common.h>
+#include <logger.h>
+#include <proxy.h>
+#include <settings.h>
+
+#include <deque>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace puttle {
+
+using boost::asio::ip::tcp;
+
+/* Connections to the upstream proxies, established ahead of time.
+ *
+ * Each io_service keeps up to Settings::upstream_pool_size idle
+ * connections per proxy, refilled in the background, so an accepted
+ * client only has to send its CONNECT request. Idle connections older
+ * than Settings::upstream_pool_idle seconds are dropped before the proxy
+ * times them out. Like every object bound to an io_service, the pool is
+ * only used from the thread running it.
+ */
+class UpstreamPool : public boost::asio::io_service::service {
+public:
+    typedef boost::shared_ptr<tcp::socket> socket_ptr;
+
+    enum _CONSTANTS {
+        MAINTENANCE_INTERVAL = 1  // Seconds between expiry / refill rounds
+    };
+
+    static boost::asio::io_service::id id;
+
+    explicit UpstreamPool(boost::asio::io_service& io_service);  // NOLINT
+
+    static UpstreamPool& get(boost::asio::io_service& io_service) {  // NOLINT
+        return boost::asio::use_service<UpstreamPool>(io_service);
+    }
+
+    // Starts filling the pool, may be called from any thread
+    void start(const proxy_vector& proxies, const Settings& settings);
+
+    // Returns a connected socket to `proxy`, or a null pointer
+    socket_ptr take(const Proxy& proxy);
+
+private:
+    struct Idle {
+        Idle(socket_ptr socket_, boost::posix_time::ptime since_) :
+            socket(socket_), since(since_) {
+        }
+
+        socket_ptr socket;
+        boost::posix_time::ptime since;
+    };
+
+    struct Slot {
+        explicit Slot(boost::shared_ptr<Proxy> proxy_) :
+            proxy(proxy_), connecting(0), failed(false) {
+        }
+
+        boost::shared_ptr<Proxy> proxy;
+        std::deque<Idle> idle;  // Oldest first
+        size_t connecting;
+        bool failed;            // Wait for the next maintenance round
+    };
+
+    void shutdown_service();
+
+    void init(proxy_vector proxies, const Settings* settings);
+    void fill(size_t slot);
+    void expire();
+    void schedule_maintenance();
+
+    void handle_maintenance(const boost::system::error_code& error);
+    void handle_resolve(size_t slot, const boost::system::error_code& error,
+                        tcp::resolver::iterator endpoint_iterator);
+    void handle_connect(size_t slot, socket_ptr socket,
+                        const boost::system::error_code& error,
+                        tcp::resolver::iterator endpoint_iterator);
+
+    static bool is_alive(tcp::socket& socket);  // NOLINT
+    static boost::posix_time::ptime now();
+
+    boost::asio::io_service& io_service_;
+    std::vector<Slot> slots_;
+    const Settings* settings_;
+    boost::asio::deadline_timer timer_;
+    bool stopped_;
+    Logger::Log log;
+};
+}
+
+#endif /* end of include guard: PUTTLE_SRC_UPSTREAM_POOL_H */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <access_record.h>
+
+#include <cstring>
+#include <string>
+
+using ::puttle::AccessLogHeader;
+using ::puttle::AccessRecord;
+
+BOOST_AUTO_TEST_SUITE(access_log)
+
+BOOST_AUTO_TEST_CASE(record) {
+    AccessRecord record;
+    memset(&record, 0, sizeof(record));
+
+    record.start = 1300000000123456ULL;
+    record.duration = 2500000;
+    record.setup = 1500;
+    record.bytes_up = 42;
+    record.bytes_down = 1024;
+    AccessRecord::set_address(record.client, boost::asio::ip::address::from_string("127.0.0.1"));
+    record.client_port = 40000;
+    AccessRecord::set_address(record.destination, boost::asio::ip::address::from_string("10.0.0.1"));
+    record.destination_port = 443;
+    AccessRecord::set_address(record.proxy, boost::asio::ip::address::from_string("2001:db8::1"));
+    record.proxy_port = 3128;
+    record.status = 200;
+    record.reason = AccessRecord::CLOSE_SERVER;
+
+    BOOST_CHECK(AccessRecord::get_address(record.client).is_v4());
+    BOOST_CHECK_EQUAL(AccessRecord::get_address(record.proxy).to_string(), "2001:db8::1");
+
+    BOOST_CHECK_EQUAL(record.str(),
+                      "2011-03-13T07:06:40.123456 127.0.0.1:40000 -> 10.0.0.1:443 via [2001:db8::1]:3128 "
+                      "status 200 up 42 down 1024 setup 1.500ms duration 2500.000ms server-closed");
+    BOOST_CHECK_EQUAL(record.csv(),
+                      "2011-03-13T07:06:40.123456,127.0.0.1,40000,10.0.0.1,443,2001:db8::1,3128,200,"
+                      "42,1024,1500,2500000,server-closed");
+
+    // Never connected to a proxy
+    memset(record.proxy, 0, sizeof(record.proxy));
+    record.proxy_port = 0;
+    record.reason = AccessRecord::CLOSE_NO_PROXY;
+    BOOST_CHECK(record.str().find(" via - ") != std::string::npos);
+    BOOST_CHECK(record.csv().find(",443,,0,") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(header) {
+    AccessLogHeader header;
+    header.init();
+    BOOST_CHECK(header.is_valid());
+    BOOST_CHECK_EQUAL(header.count, 0U);
+
+    header.record_size = 64;
+    BOOST_CHECK(!header.is_valid());
+
+    BOOST_CHECK_EQUAL(AccessRecord::reason_name(AccessRecord::CLOSE_CLIENT), "client-closed");
+    BOOST_CHECK_EQUAL(AccessRecord::reason_name(200), "unknown");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <buffer_pool.h>
+#include <memory_budget.h>
+
+using ::puttle::BufferPool;
+using ::puttle::MemoryBudget;
+
+BOOST_AUTO_TEST_SUITE(buffer_pool)
+
+BOOST_AUTO_TEST_CASE(size_classes) {
+    boost::asio::io_service io_service;
+    BufferPool& pool = BufferPool::get(io_service);
+
+    BufferPool::Buffer b = pool.acquire(1);
+    BOOST_CHECK_EQUAL(b.size, 4096U);
+    pool.release(b);
+    BOOST_CHECK(b.data == NULL);
+    BOOST_CHECK_EQUAL(b.size, 0U);
+
+    b = pool.acquire(4096);
+    BOOST_CHECK_EQUAL(b.size, 4096U);
+    pool.release(b);
+
+    b = pool.acquire(4097);
+    BOOST_CHECK_EQUAL(b.size, 8192U);
+    pool.release(b);
+
+    b = pool.acquire(100000);
+    BOOST_CHECK_EQUAL(b.size, 131072U);
+    pool.release(b);
+
+    // Clamped to MAX_SIZE
+    b = pool.acquire(1 << 20);
+    BOOST_CHECK_EQUAL(b.size, 262144U);
+    pool.release(b);
+
+    // Releasing an empty buffer does nothing
+    pool.release(b);
+    BOOST_CHECK_EQUAL(pool.in_use(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(reuse) {
+    boost::asio::io_service io_service;
+    BufferPool& pool = BufferPool::get(io_service);
+
+    BufferPool::Buffer a = pool.acquire(8192);
+    BufferPool::Buffer b = pool.acquire(8192);
+    char* data = a.data;
+    BOOST_CHECK(a.data != b.data);
+    BOOST_CHECK_EQUAL(pool.in_use(), 16384U);
+    BOOST_CHECK_EQUAL(pool.cached(), 0U);
+
+    pool.release(a);
+    BOOST_CHECK_EQUAL(pool.in_use(), 8192U);
+    BOOST_CHECK_EQUAL(pool.cached(), 8192U);
+
+    // Same size class, the released buffer comes back
+    a = pool.acquire(5000);
+    BOOST_CHECK(a.data == data);
+    BOOST_CHECK_EQUAL(pool.cached(), 0U);
+
+    // Another size class does not take it
+    pool.release(a);
+    BufferPool::Buffer c = pool.acquire(4096);
+    BOOST_CHECK(c.data != data);
+    BOOST_CHECK_EQUAL(pool.cached(), 8192U);
+    pool.release(b);
+    pool.release(c);
+
+    // At most MAX_CACHED_BYTES per size class are kept
+    BufferPool::Buffer large[5];
+    for (size_t i = 0; i < 5; ++i)
+        large[i] = pool.acquire(BufferPool::MAX_SIZE);
+    for (size_t i = 0; i < 5; ++i)
+        pool.release(large[i]);
+    BOOST_CHECK_EQUAL(pool.in_use(), 0U);
+    BOOST_CHECK_EQUAL(pool.cached(), 2 * 8192U + 4096U + BufferPool::MAX_CACHED_BYTES);
+}
+
+BOOST_AUTO_TEST_CASE(budget) {
+    boost::asio::io_service io_service;
+    BufferPool& pool = BufferPool::get(io_service);
+    MemoryBudget& budget = MemoryBudget::get(io_service);
+    budget.set_limit(65536);
+
+    BufferPool::Buffer a = pool.acquire(32768);
+    BOOST_CHECK_EQUAL(budget.used(), 32768U);
+    BufferPool::Buffer b = pool.acquire(32768);
+    BOOST_CHECK_EQUAL(budget.used(), 65536U);
+    BOOST_CHECK(budget.exhausted());
+
+    // Cached buffers are not charged
+    pool.release(a);
+    BOOST_CHECK_EQUAL(budget.used(), 32768U);
+    BOOST_CHECK(!budget.exhausted());
+
+    a = pool.acquire(32768);
+    BOOST_CHECK_EQUAL(budget.used(), 65536U);
+    pool.release(a);
+    pool.release(b);
+    BOOST_CHECK_EQUAL(budget.used(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <http_parser.h>
+#include <connect_request.h>
+
+#include <string>
+
+using ::puttle::BodyDrain;
+using ::puttle::ConnectRequest;
+using ::puttle::ResponseParser;
+using ::puttle::Slice;
+
+BOOST_AUTO_TEST_SUITE(http)
+
+BOOST_AUTO_TEST_CASE(connect_request) {
+    ConnectRequest request;
+    request.set_destination(0xc0a86401, 443);
+
+    BOOST_CHECK_EQUAL(request.host().str(), "192.168.100.1");
+    BOOST_CHECK_EQUAL(request.port().str(), "443");
+    BOOST_CHECK_EQUAL(request.str("Proxy-Authorization: Basic dTpw\r\n"),
+                      "CONNECT 192.168.100.1:443 HTTP/1.1\r\n"
+                      "User-Agent: Mozilla/5.0 (X11; U; AmigaOS x86_64; eo-EO; rv:42.6.6)\r\n"
+                      "Proxy-Connection: keep-alive\r\n"
+                      "Host: 192.168.100.1:443\r\n"
+                      "Proxy-Authorization: Basic dTpw\r\n"
+                      "\r\n");
+
+    request.set_destination(0, 65535);
+    BOOST_CHECK_EQUAL(request.str("").substr(0, 32), "CONNECT 0.0.0.0:65535 HTTP/1.1\r\n");
+}
+
+BOOST_AUTO_TEST_CASE(response) {
+    std::string answer = "HTTP/1.0 407 Proxy Authentication Required\r\n" \
+                         "Proxy-Authenticate: Basic realm=\"proxy\"\r\n" \
+                         "content-length:  12 \r\n" \
+                         "garbage\r\n" \
+                         "\r\n" \
+                         "SSH-2.0-tunnel";
+    ResponseParser parser;
+
+    // Resumed at every byte, as it may come from the socket
+    size_t i = 1;
+    for (; i < answer.size(); ++i) {
+        if (parser.parse(answer.data(), i) != ResponseParser::INCOMPLETE)
+            break;
+    }
+
+    BOOST_CHECK_EQUAL(parser.parse(answer.data(), answer.size()), ResponseParser::COMPLETE);
+    BOOST_CHECK_EQUAL(answer.substr(parser.size()), "SSH-2.0-tunnel");
+    BOOST_CHECK_EQUAL(i, parser.size());
+    BOOST_CHECK_EQUAL(parser.status(), 407);
+    BOOST_CHECK_EQUAL(parser.version_major(), 1);
+    BOOST_CHECK_EQUAL(parser.version_minor(), 0);
+    BOOST_CHECK_EQUAL(parser.header_count(), 2);
+    BOOST_CHECK_EQUAL(parser.header(0).value.str(), "Basic realm=\"proxy\"");
+
+    const Slice* length = parser.find("Content-Length");
+    uint64_t n = 0;
+    BOOST_REQUIRE(length != NULL);
+    BOOST_CHECK_EQUAL(length->to_uint64(&n), true);
+    BOOST_CHECK_EQUAL(n, 12);
+    BOOST_CHECK(parser.find("Connection") == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(response_bare_lf) {
+    std::string answer = "HTTP/1.1 200 Connection established\n\n";
+    ResponseParser parser;
+
+    BOOST_CHECK_EQUAL(parser.parse(answer.data(), answer.size()), ResponseParser::COMPLETE);
+    BOOST_CHECK_EQUAL(parser.status(), 200);
+    BOOST_CHECK_EQUAL(parser.size(), answer.size());
+}
+
+BOOST_AUTO_TEST_CASE(response_invalid) {
+    std::string answer = "SSH-2.0-OpenSSH\r\n";
+    ResponseParser parser;
+    BOOST_CHECK_EQUAL(parser.parse(answer.data(), answer.size()), ResponseParser::INVALID);
+
+    answer = "HTTP/1.1 2000 OK\r\n";
+    parser.reset();
+    BOOST_CHECK_EQUAL(parser.parse(answer.data(), answer.size()), ResponseParser::INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(drain_length) {
+    BodyDrain drain;
+    drain.reset_length(10);
+
+    BOOST_CHECK_EQUAL(drain.consume("0123", 4), 4);
+    BOOST_CHECK_EQUAL(drain.done(), false);
+    BOOST_CHECK_EQUAL(drain.consume("456789HTTP", 10), 6);
+    BOOST_CHECK_EQUAL(drain.done(), true);
+
+    drain.reset_length(0);
+    BOOST_CHECK_EQUAL(drain.done(), true);
+}
+
+BOOST_AUTO_TEST_CASE(drain_chunked) {
+    std::string body = "5;ext=1\r\nhello\r\n1A\r\nabcdefghijklmnopqrstuvwxyz\r\n0\r\n\r\nnext";
+    BodyDrain drain;
+    drain.reset_chunked(1024);
+
+    // Byte by byte, as it may come from the socket
+    size_t consumed = 0;
+    for (size_t i = 0; i < body.size() && !drain.done(); ++i)
+        consumed += drain.consume(body.data() + i, 1);
+
+    BOOST_CHECK_EQUAL(drain.done(), true);
+    BOOST_CHECK_EQUAL(body.substr(consumed), "next");
+}
+
+BOOST_AUTO_TEST_CASE(drain_chunked_trailers) {
+    std::string body = "3\nabc\n0\nX-Trailer: yes\r\n\r\n";
+    BodyDrain drain;
+    drain.reset_chunked(1024);
+
+    BOOST_CHECK_EQUAL(drain.consume(body.data(), body.size()), body.size());
+    BOOST_CHECK_EQUAL(drain.done(), true);
+}
+
+BOOST_AUTO_TEST_CASE(drain_chunked_invalid) {
+    std::string body = "zz\r\n";
+    BodyDrain drain;
+    drain.reset_chunked(1024);
+
+    drain.consume(body.data(), body.size());
+    BOOST_CHECK_EQUAL(drain.failed(), true);
+    BOOST_CHECK_EQUAL(drain.done(), false);
+}
+
+BOOST_AUTO_TEST_CASE(drain_chunked_limit) {
+    std::string chunk = "10\r\n0123456789abcdef\r\n";
+    BodyDrain drain;
+    drain.reset_chunked(64);
+
+    // An endless body fails once the limit is crossed
+    size_t sent = 0;
+    while (!drain.failed() && sent < 1024) {
+        drain.consume(chunk.data(), chunk.size());
+        sent += chunk.size();
+    }
+    BOOST_CHECK_EQUAL(drain.failed(), true);
+    BOOST_CHECK(sent <= 64 + chunk.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <metrics.h>
+#include <memory_budget.h>
+#include <proxy.h>
+
+#include <string>
+#include <vector>
+
+using ::puttle::Histogram;
+using ::puttle::Metrics;
+using ::puttle::MemoryBudget;
+using ::puttle::Proxy;
+using ::puttle::ios_deque;
+using ::puttle::io_service_ptr;
+using ::puttle::proxy_vector;
+
+BOOST_AUTO_TEST_SUITE(metrics)
+
+BOOST_AUTO_TEST_CASE(histogram_buckets) {
+    BOOST_CHECK_EQUAL(Histogram::bucket(0), 0U);
+    BOOST_CHECK_EQUAL(Histogram::bucket(7), 7U);
+    BOOST_CHECK_EQUAL(Histogram::bucket(15), 15U);
+    BOOST_CHECK_EQUAL(Histogram::bucket(16), 16U);
+    BOOST_CHECK_EQUAL(Histogram::bucket(17), 16U);
+    BOOST_CHECK_EQUAL(Histogram::bucket(18), 17U);
+    BOOST_CHECK_EQUAL(Histogram::bucket(~0ULL), Histogram::BUCKETS - 1U);
+
+    // Every value is within 12.5% of the top of its bucket
+    for (uint64_t v = 1; v < (1ULL << 34); v = v * 3 + 1) {
+        uint64_t max = Histogram::bucket_max(Histogram::bucket(v));
+        BOOST_CHECK(max >= v);
+        BOOST_CHECK(max <= v + v / 8);
+        BOOST_CHECK_EQUAL(Histogram::bucket(max), Histogram::bucket(v));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(histogram_quantiles) {
+    Histogram h;
+    for (uint64_t v = 1; v <= 1000; ++v)
+        h.record(v);
+
+    std::vector<uint64_t> counts(Histogram::BUCKETS);
+    uint64_t sum = 0;
+    h.merge_into(&counts, &sum);
+
+    BOOST_CHECK_EQUAL(sum, 500500U);
+    BOOST_CHECK_EQUAL(Histogram::value_at(counts, 0.5), 511U);
+    BOOST_CHECK_EQUAL(Histogram::value_at(counts, 1), 1023U);
+    BOOST_CHECK_EQUAL(Histogram::value_at(std::vector<uint64_t>(Histogram::BUCKETS), 0.5), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(render) {
+    proxy_vector proxies;
+    proxies.push_back(boost::shared_ptr<Proxy>(new Proxy("proxy.lan", 8080)));
+
+    ios_deque io_services;
+    for (int i = 0; i < 2; ++i) {
+        io_services.push_back(io_service_ptr(new boost::asio::io_service()));
+        Metrics& m = Metrics::get(*io_services.back());
+        m.init(proxies);
+        m.accepted.add(3);
+        m.proxy(*proxies[0]).opened.add(2);
+        m.proxy(*proxies[0]).closed.add(1);
+        m.proxy(*proxies[0]).refused.add(i);
+        m.proxy(*proxies[0]).connect.record(1500);
+        m.throttled_reads.add(i);
+        MemoryBudget::get(*io_services.back()).set_limit(1000);
+        MemoryBudget::get(*io_services.back()).charge(100);
+    }
+
+    // Not known to init(), ignored
+    Proxy other("other.lan");
+    Metrics::get(*io_services.front()).proxy(other).opened.add(5);
+
+    std::string text = Metrics::render(io_services, proxies);
+    BOOST_CHECK(text.find("puttle_accepted_total 6\n") != std::string::npos);
+    BOOST_CHECK(text.find("puttle_proxy_tunnels_total{proxy=\"proxy.lan:8080\"} 4\n") != std::string::npos);
+    BOOST_CHECK(text.find("puttle_proxy_active_tunnels{proxy=\"proxy.lan:8080\"} 2\n") != std::string::npos);
+    BOOST_CHECK(text.find("puttle_proxy_failures_total{proxy=\"proxy.lan:8080\",phase=\"refused\"} 1\n")
+                != std::string::npos);
+    BOOST_CHECK(text.find("puttle_proxy_connect_seconds_count{proxy=\"proxy.lan:8080\"} 2\n") != std::string::npos);
+    BOOST_CHECK(text.find("puttle_proxy_connect_seconds_sum{proxy=\"proxy.lan:8080\"} 0.003\n") != std::string::npos);
+    BOOST_CHECK(text.find("# TYPE puttle_proxy_connect_seconds summary\n") != std::string::npos);
+    BOOST_CHECK(text.find("puttle_throttled_total{operation=\"read\"} 1\n") != std::string::npos);
+    BOOST_CHECK(text.find("puttle_memory_bytes 200\n") != std::string::npos);
+    BOOST_CHECK(text.find("puttle_memory_budget_bytes 2000\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(memory_budget) {
+    boost::asio::io_service io_service;
+    MemoryBudget& budget = MemoryBudget::get(io_service);
+
+    // Unlimited by default
+    budget.charge(1 << 30);
+    BOOST_CHECK(!budget.throttled());
+    BOOST_CHECK(!budget.exhausted());
+    budget.credit(1 << 30);
+
+    budget.set_limit(1000);
+    budget.charge(799);
+    BOOST_CHECK(!budget.throttled());
+    budget.charge(1);
+    BOOST_CHECK(budget.throttled());
+    BOOST_CHECK(!budget.exhausted());
+    budget.charge(200);
+    BOOST_CHECK(budget.exhausted());
+    budget.credit(500);
+    BOOST_CHECK_EQUAL(budget.used(), 500U);
+    BOOST_CHECK(!budget.throttled());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
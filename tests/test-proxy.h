@@ -19,11 +19,19 @@
  *
  */
 #include <authenticator.h>
+#include <proxy_selection.h>
+#include <circuit_breaker.h>
 
 #include <map>
 #include <string>
 
+#include <boost/lexical_cast.hpp>
+
 using ::puttle::Proxy;
+using ::puttle::ProxyStats;
+using ::puttle::CircuitBreaker;
+using ::puttle::Settings;
+using ::puttle::proxy_vector;
 
 BOOST_AUTO_TEST_SUITE(proxy)
 
@@ -53,4 +61,67 @@ BOOST_AUTO_TEST_CASE(borked) {
     BOOST_CHECK_EQUAL(p.host, "fbi.gov.gouv.edu.mil.fr");
     BOOST_CHECK_EQUAL(p.port, 3129);
 }
+
+BOOST_AUTO_TEST_CASE(stats) {
+    ProxyStats stats;
+    stats.record_connect(8000);
+    BOOST_CHECK_EQUAL(stats.connect_latency(), 8000);
+    stats.record_connect(16000);
+    BOOST_CHECK_EQUAL(stats.connect_latency(), 9000);
+
+    stats.record_failure();
+    BOOST_CHECK_EQUAL(stats.failure_score(), ProxyStats::FAILURE_SCALE / 8);
+    stats.record_success();
+    BOOST_CHECK_EQUAL(stats.failure_score(), ProxyStats::FAILURE_SCALE / 8 - ProxyStats::FAILURE_SCALE / 64);
+}
+
+BOOST_AUTO_TEST_CASE(selection) {
+    proxy_vector proxies;
+    for (int i = 0; i < 3; ++i)
+        proxies.push_back(boost::shared_ptr<Proxy>(new Proxy("proxy" + boost::lexical_cast<std::string>(i))));
+
+    proxies[0]->stats->record_connect(50000);
+    proxies[1]->stats->record_connect(10000);
+    proxies[2]->stats->record_connect(10000);
+    proxies[2]->stats->tunnel_opened();
+
+    // proxy1 and proxy2 are as fast, but proxy2 already carries a tunnel
+    for (int i = 0; i < 10; ++i) {
+        puttle::select_proxies(proxies, Settings::SELECT_LEAST_LOADED);
+        BOOST_CHECK_EQUAL(proxies[0]->host, "proxy1");
+        BOOST_CHECK_EQUAL(proxies[1]->host, "proxy2");
+        BOOST_CHECK_EQUAL(proxies[2]->host, "proxy0");
+
+        // The slowest proxy never wins two random choices
+        puttle::select_proxies(proxies, Settings::SELECT_P2C);
+        BOOST_CHECK(proxies[0]->host != "proxy0");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(breaker) {
+    CircuitBreaker breaker;
+    breaker.configure(2, 0);
+
+    breaker.record_failure();
+    BOOST_CHECK_EQUAL(breaker.state(), CircuitBreaker::CLOSED);
+    breaker.record_failure();
+    BOOST_CHECK_EQUAL(breaker.state(), CircuitBreaker::OPEN);
+
+    // No cooldown: one probe right away, then one per PROBE_INTERVAL.
+    // available() does not claim it
+    BOOST_CHECK_EQUAL(breaker.available(), true);
+    BOOST_CHECK_EQUAL(breaker.state(), CircuitBreaker::OPEN);
+    BOOST_CHECK_EQUAL(breaker.allow(), true);
+    BOOST_CHECK_EQUAL(breaker.state(), CircuitBreaker::HALF_OPEN);
+    BOOST_CHECK_EQUAL(breaker.available(), false);
+    BOOST_CHECK_EQUAL(breaker.allow(), false);
+
+    breaker.record_success();
+    BOOST_CHECK_EQUAL(breaker.state(), CircuitBreaker::CLOSED);
+    BOOST_CHECK_EQUAL(breaker.allow(), true);
+
+    breaker.configure(1, 60);
+    breaker.record_failure();
+    BOOST_CHECK_EQUAL(breaker.allow(), false);
+}
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <resolve_cache.h>
+
+#include <boost/thread/thread.hpp>
+
+using ::puttle::ResolveCache;
+using boost::asio::ip::tcp;
+
+namespace {
+struct Lookup {
+    Lookup() : done(0) {
+    }
+
+    void handle(const boost::system::error_code& error_, tcp::resolver::iterator results_) {
+        error = error_;
+        results = results_;
+        ++done;
+    }
+
+    boost::system::error_code error;
+    tcp::resolver::iterator results;
+    int done;
+};
+
+// Resolves through the cache, `io_service` must be run to get the answer
+void lookup(boost::asio::io_service& io_service, uint16_t port, Lookup* l) {  // NOLINT
+    ResolveCache::instance().async_resolve(io_service, "127.0.0.1", port,
+                                           boost::bind(&Lookup::handle, l, _1, _2));
+}
+
+void run(boost::asio::io_service& io_service) {  // NOLINT
+    io_service.run();
+    io_service.reset();
+}
+}
+
+/* The cache is process-wide, each test uses its own port. Separate
+ * resolutions of a host return distinct result lists, comparing the
+ * iterators tells whether an answer came from the same resolution.
+ */
+BOOST_AUTO_TEST_SUITE(resolve_cache)
+
+BOOST_AUTO_TEST_CASE(shared_resolution) {
+    boost::asio::io_service io_service;
+    ResolveCache::instance().set_ttl(60, 5);
+
+    // Concurrent misses wait for the first resolution
+    Lookup a, b, c;
+    lookup(io_service, 8001, &a);
+    lookup(io_service, 8001, &b);
+    BOOST_CHECK_EQUAL(a.done, 0);
+    run(io_service);
+    BOOST_CHECK_EQUAL(a.done, 1);
+    BOOST_CHECK_EQUAL(b.done, 1);
+    BOOST_CHECK(!a.error);
+    BOOST_CHECK(a.results != tcp::resolver::iterator());
+    BOOST_CHECK(a.results == b.results);
+    BOOST_CHECK_EQUAL(a.results->endpoint(), tcp::endpoint(boost::asio::ip::address_v4::loopback(), 8001));
+
+    // Then the answer is cached, still delivered through the io_service
+    lookup(io_service, 8001, &c);
+    BOOST_CHECK_EQUAL(c.done, 0);
+    run(io_service);
+    BOOST_CHECK_EQUAL(c.done, 1);
+    BOOST_CHECK(c.results == a.results);
+
+    // Another port is another entry
+    Lookup d;
+    lookup(io_service, 8002, &d);
+    run(io_service);
+    BOOST_CHECK(!d.error);
+    BOOST_CHECK(d.results != a.results);
+}
+
+BOOST_AUTO_TEST_CASE(expiry) {
+    boost::asio::io_service io_service;
+    ResolveCache::instance().set_ttl(1, 5);
+
+    Lookup a;
+    lookup(io_service, 8003, &a);
+    run(io_service);
+    BOOST_CHECK(!a.error);
+
+    // Expired: the stale answer is served while it is refreshed
+    boost::this_thread::sleep(boost::posix_time::milliseconds(1100));
+    Lookup b;
+    lookup(io_service, 8003, &b);
+    run(io_service);
+    BOOST_CHECK_EQUAL(b.done, 1);
+    BOOST_CHECK(b.results == a.results);
+
+    Lookup c;
+    lookup(io_service, 8003, &c);
+    run(io_service);
+    BOOST_CHECK(!c.error);
+    BOOST_CHECK(c.results != a.results);
+
+    // Past its ttl twice, an answer is resolved again before being served
+    ResolveCache::instance().set_ttl(0, 5);
+    Lookup d, e;
+    lookup(io_service, 8004, &d);
+    run(io_service);
+    lookup(io_service, 8004, &e);
+    run(io_service);
+    BOOST_CHECK(!e.error);
+    BOOST_CHECK(e.results != d.results);
+
+    ResolveCache::instance().set_ttl(60, 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
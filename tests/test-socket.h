@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2011 Camille Moncelier
+ *
+ * This file is part of puttle.
+ *
+ * puttle is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * puttle is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with puttle in the COPYING.txt file.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <socket_options.h>
+#include <netinet/tcp.h>
+
+#include <string>
+
+#include <boost/asio.hpp>
+
+using ::puttle::SocketProfile;
+using ::puttle::apply_socket_profile;
+using ::puttle::enable_fast_open;
+
+BOOST_AUTO_TEST_SUITE(socket_profile)
+
+BOOST_AUTO_TEST_CASE(parse) {
+    SocketProfile p;
+    BOOST_CHECK(SocketProfile::parse("nodelay,sndbuf=262144,rcvbuf=131072,notsent-lowat=16384,"
+                                     "keepidle=60,keepintvl=10,keepcnt=5,user-timeout=30000,congestion=bbr", &p));
+    BOOST_CHECK(p.no_delay);
+    BOOST_CHECK_EQUAL(p.send_buffer, 262144);
+    BOOST_CHECK_EQUAL(p.receive_buffer, 131072);
+    BOOST_CHECK_EQUAL(p.notsent_lowat, 16384);
+    BOOST_CHECK_EQUAL(p.keepalive_idle, 60);
+    BOOST_CHECK_EQUAL(p.keepalive_interval, 10);
+    BOOST_CHECK_EQUAL(p.keepalive_count, 5);
+    BOOST_CHECK_EQUAL(p.user_timeout, 30000);
+    BOOST_CHECK_EQUAL(p.congestion, "bbr");
+
+    BOOST_CHECK(SocketProfile::parse("nodelay=0, keepidle = 30", &p));
+    BOOST_CHECK(!p.no_delay);
+    BOOST_CHECK_EQUAL(p.keepalive_idle, 30);
+    BOOST_CHECK_EQUAL(p.send_buffer, 0);
+    BOOST_CHECK(p.congestion.empty());
+
+    BOOST_CHECK(SocketProfile::parse("default", &p));
+    BOOST_CHECK(!p.no_delay);
+    BOOST_CHECK_EQUAL(p.keepalive_idle, 0);
+}
+
+BOOST_AUTO_TEST_CASE(parse_invalid) {
+    SocketProfile p;
+    p.send_buffer = 4096;
+    BOOST_CHECK(!SocketProfile::parse("sndbuf", &p));
+    BOOST_CHECK(!SocketProfile::parse("sndbuf=-1", &p));
+    BOOST_CHECK(!SocketProfile::parse("keepidle=soon", &p));
+    BOOST_CHECK(!SocketProfile::parse("nodelay,fastest", &p));
+    BOOST_CHECK(!SocketProfile::parse("congestion=", &p));
+    BOOST_CHECK_EQUAL(p.send_buffer, 4096);
+}
+
+BOOST_AUTO_TEST_CASE(apply) {
+    boost::asio::io_service io_service;
+    boost::asio::ip::tcp::socket socket(io_service);
+    socket.open(boost::asio::ip::tcp::v4());
+
+    SocketProfile p;
+    BOOST_CHECK(SocketProfile::parse("nodelay,sndbuf=65536,keepidle=60,keepcnt=3", &p));
+    BOOST_CHECK(!apply_socket_profile(socket, p));
+
+    boost::asio::ip::tcp::no_delay no_delay;
+    socket.get_option(no_delay);
+    BOOST_CHECK(no_delay.value());
+
+    boost::asio::socket_base::keep_alive keep_alive;
+    socket.get_option(keep_alive);
+    BOOST_CHECK(keep_alive.value());
+
+    BOOST_CHECK(SocketProfile::parse("congestion=no-such-algorithm", &p));
+    BOOST_CHECK(apply_socket_profile(socket, p));
+}
+
+BOOST_AUTO_TEST_CASE(fast_open) {
+    boost::asio::io_service io_service;
+    boost::asio::ip::tcp::acceptor acceptor(io_service,
+            boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    int queue = 16;
+    setsockopt(acceptor.native_handle(), IPPROTO_TCP, TCP_FASTOPEN, &queue, sizeof(queue));
+
+    // Twice: the first connection gets the cookie, the second sends its data in the SYN
+    for (int i = 0; i < 2; ++i) {
+        boost::asio::ip::tcp::socket client(io_service);
+        client.open(boost::asio::ip::tcp::v4());
+        if (enable_fast_open(client)) {
+            BOOST_TEST_MESSAGE("TCP_FASTOPEN_CONNECT unsupported, skipping");
+            return;
+        }
+        client.connect(acceptor.local_endpoint());
+        boost::asio::write(client, boost::asio::buffer("CONNECT", 7));
+
+        boost::asio::ip::tcp::socket server(io_service);
+        acceptor.accept(server);
+        char request[7];
+        boost::asio::read(server, boost::asio::buffer(request));
+        BOOST_CHECK_EQUAL(std::string(request, sizeof(request)), "CONNECT");
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
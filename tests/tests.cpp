@@ -24,3 +24,9 @@
 
 #include "./test-authenticator.h"
 #include "./test-proxy.h"
+#include "./test-http.h"
+#include "./test-access-log.h"
+#include "./test-metrics.h"
+#include "./test-socket.h"
+#include "./test-buffer-pool.h"
+#include "./test-resolve-cache.h"